@@ -0,0 +1,234 @@
+
+#include "bdd.h"
+#include <algorithm>
+
+bdd_manager::bdd_manager(int n)
+: num_vars(n), num_nodes(2), gc_threshold(1 << 18), free_list(-1)
+{
+  node terminal = { n, 0, 0, -1 };
+  nodes.push_back(terminal);    // BDD_FALSE
+  terminal.lo = terminal.hi = 1;
+  nodes.push_back(terminal);    // BDD_TRUE
+  buckets.assign(1 << 12, -1);
+  cache_entry empty = { 0, 0, 0, 0 };
+  cache.assign(1 << 12, empty);
+}
+
+unsigned bdd_manager::hash(int v, bdd lo, bdd hi) const
+{
+  unsigned h = v * 0x9E3779B1u;
+  h ^= lo * 0x85EBCA77u + (h << 6) + (h >> 2);
+  h ^= hi * 0xC2B2AE3Du + (h << 6) + (h >> 2);
+  return h ^ (h >> 15);
+}
+
+bool bdd_manager::cacheFind(int op, bdd f, bdd g, bdd& result) const
+{
+  const cache_entry& e = cache[hash(op, f, g) & (cache.size() - 1)];
+  if (e.op != op || e.f != f || e.g != g) return false;
+  result = e.result;
+  return true;
+}
+
+void bdd_manager::cacheAdd(int op, bdd f, bdd g, bdd result)
+{
+  cache_entry& e = cache[hash(op, f, g) & (cache.size() - 1)];
+  e.op = op;
+  e.f = f;
+  e.g = g;
+  e.result = result;
+}
+
+void bdd_manager::grow()
+{
+  buckets.assign(buckets.size() * 2, -1);
+  for (int i = 2; i < (int) nodes.size(); i++) {
+    if (nodes[i].var < 0) continue;
+    unsigned b = hash(nodes[i].var, nodes[i].lo, nodes[i].hi) & (buckets.size() - 1);
+    nodes[i].next = buckets[b];
+    buckets[b] = i;
+  }
+  cache_entry empty = { 0, 0, 0, 0 };
+  cache.assign(cache.size() * 2, empty);
+}
+
+bdd bdd_manager::makeNode(int v, bdd lo, bdd hi)
+{
+  if (lo == hi) return lo;
+
+  unsigned b = hash(v, lo, hi) & (buckets.size() - 1);
+  for (int i = buckets[b]; i >= 0; i = nodes[i].next) {
+    if (nodes[i].var == v && nodes[i].lo == lo && nodes[i].hi == hi) return i;
+  }
+
+  int i;
+  if (free_list >= 0) {
+    i = free_list;
+    free_list = nodes[i].next;
+  } else {
+    i = nodes.size();
+    nodes.push_back(node());
+  }
+  nodes[i].var = v;
+  nodes[i].lo = lo;
+  nodes[i].hi = hi;
+  nodes[i].next = buckets[b];
+  buckets[b] = i;
+  if (++num_nodes > (int) buckets.size()) grow();
+  return i;
+}
+
+bdd bdd_manager::NOT(bdd f)
+{
+  if (f == BDD_FALSE) return BDD_TRUE;
+  if (f == BDD_TRUE) return BDD_FALSE;
+
+  bdd r;
+  if (cacheFind(OP_NOT, f, 0, r)) return r;
+  int v = var(f);
+  bdd f0 = low(f), f1 = high(f);
+  bdd r0 = NOT(f0);
+  bdd r1 = NOT(f1);
+  r = makeNode(v, r0, r1);
+  cacheAdd(OP_NOT, f, 0, r);
+  return r;
+}
+
+bdd bdd_manager::AND(bdd f, bdd g) { return apply(OP_AND, f, g); }
+bdd bdd_manager::OR(bdd f, bdd g) { return apply(OP_OR, f, g); }
+bdd bdd_manager::DIFF(bdd f, bdd g) { return apply(OP_DIFF, f, g); }
+
+bdd bdd_manager::apply(int op, bdd f, bdd g)
+{
+  switch (op) {
+    case OP_AND:
+      if (f == BDD_FALSE || g == BDD_FALSE) return BDD_FALSE;
+      if (f == BDD_TRUE || f == g) return g;
+      if (g == BDD_TRUE) return f;
+      if (f > g) std::swap(f, g);
+      break;
+    case OP_OR:
+      if (f == BDD_TRUE || g == BDD_TRUE) return BDD_TRUE;
+      if (f == BDD_FALSE || f == g) return g;
+      if (g == BDD_FALSE) return f;
+      if (f > g) std::swap(f, g);
+      break;
+    default: // OP_DIFF
+      if (f == BDD_FALSE || g == BDD_TRUE || f == g) return BDD_FALSE;
+      if (g == BDD_FALSE) return f;
+      if (f == BDD_TRUE) return NOT(g);
+      break;
+  }
+
+  bdd r;
+  if (cacheFind(op, f, g, r)) return r;
+  int v = std::min(var(f), var(g));
+  bdd f0 = (var(f) == v) ? low(f) : f;
+  bdd f1 = (var(f) == v) ? high(f) : f;
+  bdd g0 = (var(g) == v) ? low(g) : g;
+  bdd g1 = (var(g) == v) ? high(g) : g;
+  bdd r0 = apply(op, f0, g0);
+  bdd r1 = apply(op, f1, g1);
+  r = makeNode(v, r0, r1);
+  cacheAdd(op, f, g, r);
+  return r;
+}
+
+int bdd_manager::newVarSet(const std::vector<int>& vars)
+{
+  std::vector<char> in(num_vars + 1, 0);
+  for (size_t i = 0; i < vars.size(); i++) in[vars[i]] = 1;
+  varsets.push_back(in);
+  return varsets.size() - 1;
+}
+
+bdd bdd_manager::andExists(bdd f, bdd g, int varset)
+{
+  return andExistsRec(f, g, varset, OP_AND_EXISTS + OP_COUNT * varset);
+}
+
+bdd bdd_manager::andExistsRec(bdd f, bdd g, int varset, int op)
+{
+  if (f == BDD_FALSE || g == BDD_FALSE) return BDD_FALSE;
+  if (f == BDD_TRUE && g == BDD_TRUE) return BDD_TRUE;
+  if (f > g) std::swap(f, g);
+
+  bdd r;
+  if (cacheFind(op, f, g, r)) return r;
+  int v = std::min(var(f), var(g));
+  bdd f0 = (var(f) == v) ? low(f) : f;
+  bdd f1 = (var(f) == v) ? high(f) : f;
+  bdd g0 = (var(g) == v) ? low(g) : g;
+  bdd g1 = (var(g) == v) ? high(g) : g;
+  if (varsets[varset][v]) {
+    bdd r0 = andExistsRec(f0, g0, varset, op);
+    if (r0 == BDD_TRUE) {
+      r = BDD_TRUE;
+    } else {
+      bdd r1 = andExistsRec(f1, g1, varset, op);
+      r = OR(r0, r1);
+    }
+  } else {
+    bdd r0 = andExistsRec(f0, g0, varset, op);
+    bdd r1 = andExistsRec(f1, g1, varset, op);
+    r = makeNode(v, r0, r1);
+  }
+  cacheAdd(op, f, g, r);
+  return r;
+}
+
+int bdd_manager::newRenaming(const std::vector<int>& map)
+{
+  renamings.push_back(map);
+  return renamings.size() - 1;
+}
+
+bdd bdd_manager::rename(bdd f, int renaming)
+{
+  if (f == BDD_FALSE || f == BDD_TRUE) return f;
+
+  int op = OP_RENAME + OP_COUNT * renaming;
+  bdd r;
+  if (cacheFind(op, f, 0, r)) return r;
+  int v = renamings[renaming][var(f)];
+  bdd f0 = low(f), f1 = high(f);
+  bdd r0 = rename(f0, renaming);
+  bdd r1 = rename(f1, renaming);
+  r = makeNode(v, r0, r1);
+  cacheAdd(op, f, 0, r);
+  return r;
+}
+
+void bdd_manager::mark(bdd f, std::vector<char>& marked) const
+{
+  if (marked[f]) return;
+  marked[f] = 1;
+  mark(nodes[f].lo, marked);
+  mark(nodes[f].hi, marked);
+}
+
+void bdd_manager::gc(const std::vector<bdd>& roots)
+{
+  std::vector<char> marked(nodes.size(), 0);
+  marked[BDD_FALSE] = marked[BDD_TRUE] = 1;
+  for (size_t i = 0; i < roots.size(); i++) mark(roots[i], marked);
+
+  buckets.assign(buckets.size(), -1);
+  for (int i = 2; i < (int) nodes.size(); i++) {
+    if (nodes[i].var < 0) continue;
+    if (!marked[i]) {
+      nodes[i].var = -1;
+      nodes[i].next = free_list;
+      free_list = i;
+      num_nodes--;
+      continue;
+    }
+    unsigned b = hash(nodes[i].var, nodes[i].lo, nodes[i].hi) & (buckets.size() - 1);
+    nodes[i].next = buckets[b];
+    buckets[b] = i;
+  }
+
+  cache_entry empty = { 0, 0, 0, 0 };
+  cache.assign(cache.size(), empty);
+  gc_threshold = std::max(gc_threshold, 2 * num_nodes);
+}
@@ -0,0 +1,113 @@
+#ifndef __BDD_H__
+#define __BDD_H__
+
+#include <vector>
+
+/**
+  A small reduced ordered BDD package, used by the symbolic model.
+
+  Nodes live in a single array owned by a bdd_manager, and a bdd is
+  the index of its root node. Indices 0 and 1 are the terminals, so
+  two functions are equal iff their indices are equal. Variable v is
+  tested before variable w iff v < w.
+
+  Every node is created through a unique table, which keeps the
+  diagram reduced; the results of the recursive operations are kept
+  in a direct-mapped computed table.
+
+  There is no reference counting: nodes are only reclaimed by gc(),
+  which keeps the nodes reachable from the roots it is given and
+  frees everything else.
+*/
+typedef int bdd;
+
+const bdd BDD_FALSE = 0;
+const bdd BDD_TRUE = 1;
+
+class bdd_manager {
+  public:
+    /// Manager for variables 0..num_vars-1.
+    explicit bdd_manager(int num_vars);
+
+    int numVars() const { return num_vars; }
+
+    /// Number of nodes currently in use, terminals included.
+    int numNodes() const { return num_nodes; }
+
+    /// Top variable of f; numVars() for a terminal.
+    int var(bdd f) const { return nodes[f].var; }
+    bdd low(bdd f) const { return nodes[f].lo; }
+    bdd high(bdd f) const { return nodes[f].hi; }
+
+    /// The function "if variable v then hi else lo", reduced.
+    /// Both lo and hi must only test variables after v.
+    bdd makeNode(int v, bdd lo, bdd hi);
+
+    /// The function that is true iff variable v is true.
+    bdd ithVar(int v) { return makeNode(v, BDD_FALSE, BDD_TRUE); }
+
+    bdd NOT(bdd f);
+    bdd AND(bdd f, bdd g);
+    bdd OR(bdd f, bdd g);
+    /// f & !g
+    bdd DIFF(bdd f, bdd g);
+
+    /// Register a set of variables to quantify over; returns its id.
+    int newVarSet(const std::vector<int>& vars);
+
+    /// Exists vars . f & g, for the set of variables with the given id.
+    bdd andExists(bdd f, bdd g, int varset);
+
+    /**
+        Register a renaming of variables; returns its id.
+        map[v] is the new name of variable v. The renaming must keep
+        the relative order of the variables of any function it is
+        applied to (e.g. x_i to x_i+1 on functions of the even
+        variables only), so that no reordering is needed.
+    */
+    int newRenaming(const std::vector<int>& map);
+
+    bdd rename(bdd f, int renaming);
+
+    /// True when enough nodes were created since the last gc().
+    bool wantsGC() const { return num_nodes >= gc_threshold; }
+
+    /// Free every node not reachable from roots; clears the computed table.
+    void gc(const std::vector<bdd>& roots);
+
+  private:
+    struct node {
+      int var;      // -1 for a free node
+      bdd lo, hi;
+      int next;     // next node in the same unique table bucket, or free list
+    };
+
+    struct cache_entry {
+      int op;
+      bdd f, g;
+      bdd result;
+    };
+
+    enum { OP_NOT = 1, OP_AND, OP_OR, OP_DIFF, OP_AND_EXISTS, OP_RENAME, OP_COUNT };
+
+    bool cacheFind(int op, bdd f, bdd g, bdd& result) const;
+    void cacheAdd(int op, bdd f, bdd g, bdd result);
+    unsigned hash(int v, bdd lo, bdd hi) const;
+    void grow();
+    void mark(bdd f, std::vector<char>& marked) const;
+
+    bdd apply(int op, bdd f, bdd g);
+    bdd andExistsRec(bdd f, bdd g, int varset, int op);
+
+    int num_vars;
+    int num_nodes;
+    int gc_threshold;
+    int free_list;
+    std::vector<node> nodes;
+    std::vector<int> buckets;   // size is a power of 2
+    std::vector<cache_entry> cache;   // size is a power of 2
+    std::vector< std::vector<char> > varsets;   // varsets[id][v]: is v quantified
+    std::vector< std::vector<int> > renamings;
+};
+
+#endif
@@ -0,0 +1,383 @@
+
+/**
+    Benchmarks of the model checking operations.
+
+    Builds models of a few parameterized families, and times parsing,
+    finish() and every labeling operation of the model on them. Each
+    measurement is one line of JSON on standard output, e.g.
+
+      {"family":"chain:1000000", "model":"explicit", "threads":1,
+       "states":1000000, "arcs":1000000, "op":"EU", "reps":5,
+       "median_ms":..., "p90_ms":..., "min_ms":..., "max_ms":...,
+       "states_per_sec":..., "arcs_per_sec":..., "peak_rss_kb":...}
+
+    so that runs can be compared as the engine evolves.
+*/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <random>
+#include <sys/resource.h>
+
+#include "parser.h"
+
+using namespace std;
+
+/*
+  A generated Kripke structure: every state has at least one
+  successor. Labels p (about half the states) and q (about 1%) are
+  drawn at random, for the operators to work on.
+*/
+struct kripke {
+  int num_states;
+  vector< pair<int, int> > arcs;
+  vector<int> p, q;
+};
+
+// fill in p and q, and give states without successors a self loop
+static void finish_kripke(kripke& k, mt19937& rng) {
+  vector<char> has_succ(k.num_states, 0);
+  for (size_t a = 0; a < k.arcs.size(); a++) has_succ[k.arcs[a].first] = 1;
+  for (int s = 0; s < k.num_states; s++) {
+    if (!has_succ[s]) k.arcs.push_back(make_pair(s, s));
+  }
+  uniform_int_distribution<int> pct(0, 99);
+  for (int s = 0; s < k.num_states; s++) {
+    int r = pct(rng);
+    if (r < 50) k.p.push_back(s);
+    if (r == 0) k.q.push_back(s);
+  }
+  if (k.q.empty()) k.q.push_back(k.num_states - 1);
+}
+
+/*
+  n states with random successors. The out-degree is deg for every
+  state ("uniform"), or drawn from a power law with mean about deg
+  ("powerlaw"), so that a few states have very many successors.
+*/
+static void gen_random(kripke& k, int n, int deg, const string& dist, mt19937& rng) {
+  k.num_states = n;
+  uniform_int_distribution<int> target(0, n - 1);
+  uniform_real_distribution<double> unit(0.0, 1.0);
+  for (int s = 0; s < n; s++) {
+    int d = deg;
+    if (dist == "powerlaw") {
+      // Pareto with exponent 2.5 and minimum deg/3: mean about deg
+      double x = (deg / 3.0) * pow(1.0 - unit(rng), -1.0 / 1.5);
+      d = min<double>(x, n);
+    }
+    if (d < 1) d = 1;
+    for (int i = 0; i < d; i++) k.arcs.push_back(make_pair(s, target(rng)));
+  }
+}
+
+// s0 -> s1 -> ... -> s(n-1), with a self loop at the end: fixpoints take n steps
+static void gen_chain(kripke& k, int n) {
+  k.num_states = n;
+  for (int s = 0; s + 1 < n; s++) k.arcs.push_back(make_pair(s, s + 1));
+}
+
+// w x h grid, with arcs to the right and down neighbours, wrapping around
+static void gen_grid(kripke& k, int w, int h) {
+  k.num_states = w * h;
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      int s = y * w + x;
+      k.arcs.push_back(make_pair(s, y * w + (x + 1) % w));
+      k.arcs.push_back(make_pair(s, ((y + 1) % h) * w + x));
+    }
+  }
+}
+
+/*
+  Dining philosophers: the reachable states of n philosophers around a
+  table, each thinking (0), holding its left fork (1) or eating with
+  both forks (2); one philosopher moves at a time. The state where
+  everyone holds a left fork is a deadlock.
+*/
+static void gen_philosophers(kripke& k, int n) {
+  vector<int> pow3(n + 1, 1);
+  for (int i = 1; i <= n; i++) pow3[i] = pow3[i - 1] * 3;
+  vector<int> id(pow3[n], -1);    // global state, base 3 -> state id
+  vector<int> queue;
+  id[0] = 0;
+  queue.push_back(0);
+  for (size_t h = 0; h < queue.size(); h++) {
+    int g = queue[h];
+    for (int i = 0; i < n; i++) {
+      int me = g / pow3[i] % 3;
+      int left = g / pow3[(i + n - 1) % n] % 3;   // holds fork i when eating
+      int right = g / pow3[(i + 1) % n] % 3;      // holds fork i+1 when it holds its left fork
+      int next = -1;
+      if (me == 0 && left != 2) next = g + pow3[i];                 // take left fork
+      if (me == 1 && right == 0) next = g + pow3[i];                // take right fork, eat
+      if (me == 2) next = g - 2 * pow3[i];                          // put both down
+      if (next < 0) continue;
+      if (id[next] < 0) {
+        id[next] = queue.size();
+        queue.push_back(next);
+      }
+      k.arcs.push_back(make_pair(id[g], id[next]));
+    }
+  }
+  k.num_states = queue.size();
+}
+
+// n states, every state with every state as a successor
+static void gen_clique(kripke& k, int n) {
+  k.num_states = n;
+  for (int s = 0; s < n; s++) {
+    for (int t = 0; t < n; t++) k.arcs.push_back(make_pair(s, t));
+  }
+}
+
+/*
+  Generate from a family spec: random:n[:deg[:uniform|powerlaw]],
+  chain:n, grid:w[:h], philosophers:n, clique:n.
+*/
+static bool generate(const string& spec, unsigned seed, kripke& k) {
+  vector<string> f;
+  stringstream in(spec);
+  string part;
+  while (getline(in, part, ':')) f.push_back(part);
+  if (f.size() < 2) return false;
+  int n = atoi(f[1].c_str());
+  if (n < 1) return false;
+
+  mt19937 rng(seed);
+  k = kripke();
+  if (f[0] == "random") {
+    gen_random(k, n, f.size() > 2 ? atoi(f[2].c_str()) : 4, f.size() > 3 ? f[3] : "uniform", rng);
+  } else if (f[0] == "chain") {
+    gen_chain(k, n);
+  } else if (f[0] == "grid") {
+    gen_grid(k, n, f.size() > 2 ? atoi(f[2].c_str()) : n);
+  } else if (f[0] == "philosophers") {
+    if (n > 16) return false;
+    gen_philosophers(k, n);
+  } else if (f[0] == "clique") {
+    gen_clique(k, n);
+  } else {
+    return false;
+  }
+  finish_kripke(k, rng);
+  return true;
+}
+
+// the input format of mctool, with an empty CTL section
+static string to_text(const kripke& k) {
+  string out;
+  out.reserve(k.arcs.size() * 16);
+  char buf[64];
+  snprintf(buf, sizeof(buf), "KRIPKE\nSTATES %d\nARCS\n", k.num_states);
+  out += buf;
+  for (size_t a = 0; a < k.arcs.size(); a++) {
+    snprintf(buf, sizeof(buf), "s%d -> s%d;\n", k.arcs[a].first, k.arcs[a].second);
+    out += buf;
+  }
+  out += "LABELS\n";
+  const vector<int>* labels[2] = { &k.p, &k.q };
+  for (int l = 0; l < 2; l++) {
+    out += (l == 0) ? "p:" : "q:";
+    for (size_t i = 0; i < labels[l]->size(); i++) {
+      snprintf(buf, sizeof(buf), "%s s%d", i ? "," : "", (*labels[l])[i]);
+      out += buf;
+    }
+    out += ";\n";
+  }
+  out += "CTL\n";
+  return out;
+}
+
+struct bench_options {
+  int reps;
+  unsigned seed;
+  mc_options mc;
+  bench_options() : reps(5), seed(1) {}
+};
+
+static long peak_rss_kb() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+static double now_ms() {
+  return chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// the q-th quantile of sorted times, by nearest rank
+static double quantile(const vector<double>& t, double q) {
+  int r = (int) ceil(q * t.size()) - 1;
+  return t[max(0, min<int>(r, t.size() - 1))];
+}
+
+static void report(const string& spec, const bench_options& opts, const kripke& k,
+  const char* op, vector<double> t) {
+  sort(t.begin(), t.end());
+  double median = quantile(t, 0.5);
+  double secs = max(median, 1e-6) / 1000.0;
+  printf("{\"family\":\"%s\", \"model\":\"%s\", \"threads\":%d, \"states\":%d, \"arcs\":%zu, "
+         "\"op\":\"%s\", \"reps\":%zu, \"median_ms\":%.3f, \"p90_ms\":%.3f, \"min_ms\":%.3f, \"max_ms\":%.3f, "
+         "\"states_per_sec\":%.0f, \"arcs_per_sec\":%.0f, \"peak_rss_kb\":%ld}\n",
+         spec.c_str(), opts.mc.symbolic ? "symbolic" : "explicit", opts.mc.num_threads,
+         k.num_states, k.arcs.size(), op, t.size(), median, quantile(t, 0.9), t.front(), t.back(),
+         k.num_states / secs, k.arcs.size() / secs, peak_rss_kb());
+  fflush(stdout);
+}
+
+static model* new_bench_model(const bench_options& opts) {
+  model* m = opts.mc.symbolic ? makeSymbolicModel(0) : makeEmptyModel(0);
+  m->setNumThreads(opts.mc.num_threads);
+  return m;
+}
+
+static state_set* make_set(model* m, const vector<int>& states) {
+  state_set* s = m->makeEmptySet();
+  for (size_t i = 0; i < states.size(); i++) m->addState(states[i], s);
+  return s;
+}
+
+typedef void (model::*unary_op)(const state_set*, state_set*);
+typedef void (model::*binary_op)(const state_set*, const state_set*, state_set*);
+
+static void bench_family(const string& spec, const bench_options& opts) {
+  kripke k;
+  if (!generate(spec, opts.seed, k)) {
+    cerr << "Unknown or bad family: " << spec << endl;
+    exit(1);
+  }
+
+  // the whole front end: text to a finished model
+  string text = to_text(k);
+  vector<double> t;
+  for (int r = 0; r < opts.reps; r++) {
+    double start = now_ms();
+    model* m = parse_tokens(opts.mc, 0, text.data(), text.data() + text.size());
+    t.push_back(now_ms() - start);
+    delete m;
+  }
+  report(spec, opts, k, "parse", t);
+  string().swap(text);
+
+  // addArc() and finish() alone
+  vector<double> tb, tf;
+  model* m = 0;
+  for (int r = 0; r < opts.reps; r++) {
+    delete m;
+    m = new_bench_model(opts);
+    double start = now_ms();
+    m->setNumStates(k.num_states);
+    for (size_t a = 0; a < k.arcs.size(); a++) m->addArc(k.arcs[a].first, k.arcs[a].second);
+    double mid = now_ms();
+    if (!m->finish()) exit(1);
+    tb.push_back(mid - start);
+    tf.push_back(now_ms() - mid);
+  }
+  report(spec, opts, k, "addArc", tb);
+  report(spec, opts, k, "finish", tf);
+
+  state_set* p = make_set(m, k.p);
+  state_set* q = make_set(m, k.q);
+  // EF and AF of p hold almost everywhere on most families; q is sparse
+  struct { const char* name; unary_op op; const state_set* arg; } unary[] = {
+    { "NOT", &model::NOT, p }, { "EX", &model::EX, p }, { "AX", &model::AX, p },
+    { "EF", &model::EF, q }, { "AF", &model::AF, q }, { "EG", &model::EG, p }, { "AG", &model::AG, p }
+  };
+  struct { const char* name; binary_op op; } binary[] = {
+    { "AND", &model::AND }, { "OR", &model::OR }, { "IMPLIES", &model::IMPLIES },
+    { "EU", &model::EU }, { "AU", &model::AU }
+  };
+  for (size_t i = 0; i < sizeof(unary) / sizeof(unary[0]); i++) {
+    vector<double> t;
+    for (int r = 0; r < opts.reps; r++) {
+      state_set* res = m->makeEmptySet();
+      double start = now_ms();
+      (m->*unary[i].op)(unary[i].arg, res);
+      t.push_back(now_ms() - start);
+      m->deleteSet(res);
+    }
+    report(spec, opts, k, unary[i].name, t);
+  }
+  for (size_t i = 0; i < sizeof(binary) / sizeof(binary[0]); i++) {
+    vector<double> t;
+    for (int r = 0; r < opts.reps; r++) {
+      state_set* res = m->makeEmptySet();
+      double start = now_ms();
+      (m->*binary[i].op)(p, q, res);
+      t.push_back(now_ms() - start);
+      m->deleteSet(res);
+    }
+    report(spec, opts, k, binary[i].name, t);
+  }
+  m->deleteSet(p);
+  m->deleteSet(q);
+  delete m;
+}
+
+static int usage(const char* who) {
+  cerr << "\nUsage: " << who << " [-r reps] [-s seed] [-j threads] [-b] [-g] [family ...]\n\n";
+  cerr << "\t-r: repetitions of every measurement (default 5)\n";
+  cerr << "\t-s: seed of the random generators (default 1)\n";
+  cerr << "\t-j: number of threads of the model\n";
+  cerr << "\t-b: use the symbolic model\n";
+  cerr << "\t-g: write the model of each family in the input format\n";
+  cerr << "\t    of mctool, instead of running the benchmarks\n\n";
+  cerr << "\tFamilies: random:n[:deg[:uniform|powerlaw]], chain:n, grid:w[:h],\n";
+  cerr << "\tphilosophers:n, clique:n. Without any, a default set is run.\n\n";
+  return 1;
+}
+
+int main(int argc, const char* argv[]) {
+  bench_options opts;
+  bool gen_only = false;
+  vector<string> families;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp("-r", argv[i]) == 0 && i + 1 < argc) {
+      opts.reps = atoi(argv[++i]);
+      if (opts.reps < 1) return usage(argv[0]);
+    } else if (strcmp("-s", argv[i]) == 0 && i + 1 < argc) {
+      opts.seed = atoi(argv[++i]);
+    } else if (strcmp("-j", argv[i]) == 0 && i + 1 < argc) {
+      opts.mc.num_threads = atoi(argv[++i]);
+      if (opts.mc.num_threads < 1) return usage(argv[0]);
+    } else if (strcmp("-b", argv[i]) == 0) {
+      opts.mc.symbolic = true;
+    } else if (strcmp("-g", argv[i]) == 0) {
+      gen_only = true;
+    } else if (argv[i][0] == '-') {
+      return usage(argv[0]);
+    } else {
+      families.push_back(argv[i]);
+    }
+  }
+  if (families.empty()) {
+    families.push_back("random:200000:4:uniform");
+    families.push_back("random:200000:4:powerlaw");
+    families.push_back("chain:1000000");
+    families.push_back("grid:500:500");
+    families.push_back("philosophers:10");
+    families.push_back("clique:1000");
+  }
+
+  for (size_t f = 0; f < families.size(); f++) {
+    if (gen_only) {
+      kripke k;
+      if (!generate(families[f], opts.seed, k)) {
+        cerr << "Unknown or bad family: " << families[f] << endl;
+        return 1;
+      }
+      cout << to_text(k);
+    } else {
+      bench_family(families[f], opts);
+    }
+  }
+  return 0;
+}
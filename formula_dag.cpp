@@ -0,0 +1,340 @@
+
+#include "formula_dag.h"
+#include "op_profile.h"
+#include "thread_pool.h"
+
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+const char* opName(ctl_opcode op) {
+  static const char* names[] = {
+    "label", "!", "AX", "AF", "AG", "EX", "EF", "EG",
+    "&", "|", "->", "EU", "AU", "(", "A", "E", "U"
+  };
+  return names[op];
+}
+
+formula_dag::formula_dag(model* a_model)
+: m(a_model), profile(0)
+{
+}
+
+formula_dag::~formula_dag()
+{
+  // label sets belong to the parser; everything else was made here
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i].op != OP_LABEL && nodes[i].result) m->deleteSet(nodes[i].result);
+  }
+}
+
+int formula_dag::find(ctl_opcode op, int a, int b)
+{
+  key k = { op, a, b };
+  std::unordered_map<key, int, key_hash>::iterator iter = unique.find(k);
+  if (iter != unique.end()) return iter->second;
+
+  node n = { op, a, b, 0, 0, false };
+  nodes.push_back(n);
+  unique[k] = nodes.size() - 1;
+  return nodes.size() - 1;
+}
+
+int formula_dag::leaf(int label, state_set* sset)
+{
+  int id = find(OP_LABEL, label, -1);
+  nodes[id].result = sset;
+  return id;
+}
+
+int formula_dag::apply(ctl_opcode op, int a, int b)
+{
+  // p & q is q & p: one node for both
+  if ((op == OP_AND || op == OP_OR) && b < a) std::swap(a, b);
+  return find(op, a, b);
+}
+
+void formula_dag::retain(int id)
+{
+  node& n = nodes[id];
+  if (n.uses++ == 0 && !n.result && n.op != OP_LABEL) {
+    // the children are needed until this node is evaluated
+    n.holds = true;
+    retain(n.a);
+    if (isBinaryOperator(n.op)) retain(n.b);
+  }
+}
+
+void formula_dag::release(int id)
+{
+  node& n = nodes[id];
+  assert(n.uses > 0);
+  if (--n.uses > 0) return;
+  if (n.op != OP_LABEL && n.result) {
+    m->deleteSet(n.result);
+    n.result = 0;
+  }
+  releaseChildren(id);
+}
+
+void formula_dag::releaseChildren(int id)
+{
+  node& n = nodes[id];
+  if (!n.holds) return;
+  n.holds = false;
+  release(n.a);
+  if (isBinaryOperator(n.op)) release(n.b);
+}
+
+/*
+  Run body, which computes rset, the result of op on sset1 (and sset2);
+  when profiling, recorded as one call.
+*/
+template <class F>
+void formula_dag::timed(ctl_opcode op, const state_set* sset1, const state_set* sset2,
+  const state_set* rset, const F& body)
+{
+  if (0 == profile) {
+    body();
+    return;
+  }
+
+  // counting the states of the sets is not part of the time
+  op_profile::call c;
+  c.op = opName(op);
+  c.in1 = m->cardinality(sset1);
+  c.in2 = sset2 ? m->cardinality(sset2) : -1;
+  m->setCounters(&c.work);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  body();
+  c.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  m->setCounters(0);
+  c.out = m->cardinality(rset);
+  profile->add(c);
+}
+
+state_set* formula_dag::evaluate(int id)
+{
+  if (nodes[id].result) return nodes[id].result;
+  assert(nodes[id].op != OP_LABEL);
+
+  ctl_opcode op = nodes[id].op;
+  const state_set* sset1 = evaluate(nodes[id].a);
+  const state_set* sset2 = isBinaryOperator(op) ? evaluate(nodes[id].b) : 0;
+  state_set* rset = m->makeEmptySet();
+  timed(op, sset1, sset2, rset, [&]() { run(op, sset1, sset2, rset); });
+  nodes[id].result = rset;
+  releaseChildren(id);
+  return rset;
+}
+
+/*
+  Estimated cost of an operation, against the others: all are linear in
+  the size of the model, so only the factor matters. The fixpoints that
+  count successors or look for cycles cost the most.
+*/
+static int opCost(ctl_opcode op)
+{
+  switch (op) {
+    case OP_NOT: case OP_AND: case OP_OR: case OP_IMPLIES:  return 1;
+    case OP_EX: case OP_AX:                                 return 2;
+    case OP_EF: case OP_EU: case OP_AG:                     return 4;
+    default:                                                return 8;   // AF, AU, EG
+  }
+}
+
+// the task graph of evaluateAll()
+struct formula_dag::schedule {
+  thread_pool* pool;
+  std::vector<int> pending;                 // children not yet evaluated, by node
+  std::vector<std::vector<int> > parents;   // parents to evaluate, by node
+  std::vector<int> rank;                    // cost of the costliest chain from the node to an id
+  std::mutex lock;                          // of pending, and of the results and uses of the nodes
+};
+
+void formula_dag::evaluateAll(const std::vector<int>& ids)
+{
+  thread_pool* pool = profile ? 0 : m->concurrentPool();
+  if (0 == pool) {
+    for (size_t i = 0; i < ids.size(); i++) evaluate(ids[i]);
+    return;
+  }
+
+  // the nodes to evaluate, parents before children
+  std::vector<bool> needed(nodes.size(), false);
+  std::vector<int> todo;
+  for (size_t i = 0; i < ids.size(); i++) needed[ids[i]] = true;
+  for (int id = size() - 1; id >= 0; id--) {
+    if (!needed[id] || nodes[id].result || nodes[id].op == OP_LABEL) continue;
+    todo.push_back(id);
+    needed[nodes[id].a] = true;
+    if (isBinaryOperator(nodes[id].op)) needed[nodes[id].b] = true;
+  }
+
+  schedule s;
+  s.pool = pool;
+  s.pending.assign(nodes.size(), 0);
+  s.parents.resize(nodes.size());
+  s.rank.assign(nodes.size(), 0);
+  // a child that others retained may be released by one of them while
+  // a parent that does not hold it still has to read it: one more use
+  // keeps it until every node is evaluated
+  std::vector<int> kept;
+  for (size_t k = 0; k < todo.size(); k++) {
+    int id = todo[k];
+    const node& n = nodes[id];
+    s.rank[id] += opCost(n.op);     // the ranks of its parents are final
+    int children[2] = { n.a, (isBinaryOperator(n.op) && n.b != n.a) ? n.b : -1 };
+    for (int c = 0; c < 2; c++) {
+      if (children[c] < 0) continue;
+      node& child = nodes[children[c]];
+      if (!n.holds && child.uses > 0) {
+        child.uses++;
+        kept.push_back(children[c]);
+      }
+      if (child.result) continue;
+      s.pending[id]++;
+      s.parents[children[c]].push_back(id);
+      s.rank[children[c]] = std::max(s.rank[children[c]], s.rank[id]);
+    }
+  }
+
+  std::vector<int> ready;
+  for (size_t k = 0; k < todo.size(); k++) {
+    if (0 == s.pending[todo[k]]) ready.push_back(todo[k]);
+  }
+  start(s, ready);
+  for (size_t k = 0; k < kept.size(); k++) release(kept[k]);
+}
+
+/*
+  Run the nodes of s that are ready, side by side, and the nodes they
+  make ready. Each task takes the node of highest rank not yet taken
+  when it starts, whichever thread it runs on.
+*/
+void formula_dag::start(schedule& s, std::vector<int>& ready)
+{
+  std::sort(ready.begin(), ready.end(), [&](int x, int y) { return s.rank[x] > s.rank[y]; });
+  std::atomic<int> next(0);
+  s.pool->parallel_for(0, ready.size(), 1, [&](int lo, int hi) {
+    for (int k = lo; k < hi; k++) runTask(s, ready[next++]);
+  });
+}
+
+void formula_dag::runTask(schedule& s, int id)
+{
+  // the children are evaluated, and kept until this node is
+  node& n = nodes[id];
+  ctl_opcode op = n.op;
+  const state_set* sset1 = nodes[n.a].result;
+  const state_set* sset2 = isBinaryOperator(op) ? nodes[n.b].result : 0;
+  state_set* rset = m->makeEmptySet();
+  run(op, sset1, sset2, rset);
+
+  std::vector<int> ready;
+  {
+    std::lock_guard<std::mutex> lk(s.lock);
+    n.result = rset;
+    releaseChildren(id);
+    for (size_t k = 0; k < s.parents[id].size(); k++) {
+      if (--s.pending[s.parents[id][k]] == 0) ready.push_back(s.parents[id][k]);
+    }
+  }
+  if (!ready.empty()) start(s, ready);
+}
+
+formula_dag::change formula_dag::compare(const state_set* before, const state_set* after)
+{
+  if (m->isSubset(before, after)) return m->isSubset(after, before) ? SAME : GREW;
+  return m->isSubset(after, before) ? SHRANK : CHANGED;
+}
+
+void formula_dag::update(const model_delta& d)
+{
+  std::vector<change> changed(nodes.size(), SAME);
+  std::vector<const state_set*> before(nodes.size(), 0);   // sets of the changed nodes, before the change
+  for (size_t k = 0; k < d.labels.size(); k++) {
+    key lk = { OP_LABEL, d.labels[k].first, -1 };
+    std::unordered_map<key, int, key_hash>::iterator iter = unique.find(lk);
+    if (iter == unique.end()) continue;
+    changed[iter->second] = compare(d.labels[k].second, nodes[iter->second].result);
+    before[iter->second] = d.labels[k].second;
+  }
+
+  // children first
+  bool arcs = d.arcs_added || d.arcs_removed;
+  for (int id = 0; id < size(); id++) {
+    node& n = nodes[id];
+    if (n.op == OP_LABEL) continue;
+    if (!n.result) {
+      // not evaluated, or freed: its parents cannot know how it changed
+      changed[id] = CHANGED;
+      continue;
+    }
+    bool binary = isBinaryOperator(n.op);
+    bool temporal = !(n.op == OP_NOT || n.op == OP_AND || n.op == OP_OR || n.op == OP_IMPLIES);
+    change ca = changed[n.a], cb = binary ? changed[n.b] : SAME;
+    if (!(arcs && temporal) && ca == SAME && cb == SAME) continue;
+
+    ctl_opcode op = n.op;
+    const state_set* sset1 = evaluate(n.a);
+    const state_set* sset2 = binary ? evaluate(n.b) : 0;
+    state_set* old = n.result;
+    state_set* rset = m->makeEmptySet();
+    bool grows = !d.arcs_removed && (ca == SAME || ca == GREW) && (cb == SAME || cb == GREW);
+    bool shrinks = !d.arcs_removed && (ca == SAME || ca == SHRANK);
+    if ((op == OP_EU || op == OP_EF) && grows) {
+      // the states that may now reach the earlier result
+      state_set* check = m->makeEmptySet();
+      if (d.sources) m->copy(d.sources, check);
+      if (op == OP_EU && ca == GREW) {
+        state_set* gained = m->makeEmptySet();
+        m->NOT(before[n.a], gained);
+        m->AND(gained, sset1, gained);
+        m->OR(check, gained, check);
+        m->deleteSet(gained);
+      }
+      m->copy(old, rset);
+      if (op == OP_EU) timed(op, sset1, sset2, rset, [&]() { m->EUgrow(sset1, sset2, check, rset); });
+      else timed(op, sset1, 0, rset, [&]() { m->EUgrow(0, sset1, check, rset); });
+      m->deleteSet(check);
+    } else if (op == OP_AG && shrinks) {
+      state_set* check = m->makeEmptySet();
+      if (d.sources) m->copy(d.sources, check);
+      m->copy(old, rset);
+      timed(op, sset1, 0, rset, [&]() { m->AGshrink(sset1, check, rset); });
+      m->deleteSet(check);
+    } else {
+      timed(op, sset1, sset2, rset, [&]() { run(op, sset1, sset2, rset); });
+    }
+    n.result = rset;
+    changed[id] = compare(old, rset);
+    before[id] = old;
+  }
+
+  // the earlier sets of the labels belong to the caller
+  for (int id = 0; id < size(); id++) {
+    if (nodes[id].op != OP_LABEL && before[id]) m->deleteSet(const_cast<state_set*>(before[id]));
+  }
+}
+
+void formula_dag::run(ctl_opcode op, const state_set* sset1, const state_set* sset2, state_set* rset)
+{
+  switch (op) {
+    case OP_NOT:      m->NOT(sset1, rset);             break;
+    case OP_EX:       m->EX(sset1, rset);              break;
+    case OP_EF:       m->EF(sset1, rset);              break;
+    case OP_EG:       m->EG(sset1, rset);              break;
+    case OP_AX:       m->AX(sset1, rset);              break;
+    case OP_AF:       m->AF(sset1, rset);              break;
+    case OP_AG:       m->AG(sset1, rset);              break;
+    case OP_AND:      m->AND(sset1, sset2, rset);      break;
+    case OP_OR:       m->OR(sset1, sset2, rset);       break;
+    case OP_IMPLIES:  m->IMPLIES(sset1, sset2, rset);  break;
+    case OP_EU:       m->EU(sset1, sset2, rset);       break;
+    case OP_AU:       m->AU(sset1, sset2, rset);       break;
+    default:          assert(0);
+  }
+}
@@ -0,0 +1,142 @@
+#ifndef __FORMULA_DAG_H__
+#define __FORMULA_DAG_H__
+
+#include <vector>
+#include <unordered_map>
+
+#include "model.h"
+
+class op_profile;
+
+/// What changed in a model since its formulas were evaluated; see formula_dag::update().
+struct model_delta {
+  bool arcs_added, arcs_removed;
+  const state_set* sources;     // sources of the added arcs
+  std::vector<std::pair<int, const state_set*> > labels;   // label id, and its states before
+};
+
+// CTL formulas are compiled to a postfix program of these opcodes
+typedef enum {
+  OP_LABEL=0,                                           // push a label
+  OP_NOT, OP_AX, OP_AF, OP_AG, OP_EX, OP_EF, OP_EG,     // unary
+  OP_AND, OP_OR, OP_IMPLIES, OP_EU, OP_AU,              // binary
+  OP_LPAREN, OP_A, OP_E, OP_U                           // only while parsing
+} ctl_opcode;
+
+inline bool isUnaryOperator(ctl_opcode op) {
+  return (op >= OP_NOT && op <= OP_EG);
+}
+
+inline bool isBinaryOperator(ctl_opcode op) {
+  return (op >= OP_AND && op <= OP_AU);
+}
+
+/// The operator as written in a formula ("label" for OP_LABEL).
+const char* opName(ctl_opcode op);
+
+/**
+  All the CTL formulas of an input, as one DAG of subformulas.
+
+  Nodes are hash-consed on their operator and the ids of their
+  children, so a subformula that appears several times, in one formula
+  or in many, is a single node. Each node is evaluated at most once,
+  and its result is shared by reference by every formula using it.
+
+  Children always have smaller ids than their parents.
+
+  Results can be kept for as long as they are needed only: retain()
+  each node a query will read, and release() it once read. A node
+  retained before it is evaluated retains its children until then, so
+  that evaluating the queries one at a time frees every intermediate
+  set as soon as its last user is evaluated, and never evaluates a
+  node no query needs. Nodes never retained keep their results until
+  the dag is deleted.
+*/
+class formula_dag {
+  public:
+    struct node {
+      ctl_opcode op;
+      int a, b;             // children; for OP_LABEL, a is the label id
+      state_set* result;    // 0 until evaluated, or once freed
+      int uses;             // retain()s not yet released
+      bool holds;           // retains its children until evaluated
+    };
+
+    explicit formula_dag(model* m);
+    ~formula_dag();
+
+    /// Node for an atomic label, whose states are sset (not owned).
+    int leaf(int label, state_set* sset);
+
+    /// Node for op applied to nodes a (and b, for a binary operator).
+    int apply(ctl_opcode op, int a, int b = -1);
+
+    int size() const { return nodes.size(); }
+    const node& get(int id) const { return nodes[id]; }
+
+    /// States satisfying node id; owned by the dag.
+    state_set* evaluate(int id);
+
+    /**
+        Evaluate nodes ids, and every node they need, at once. If the
+        model can run operations concurrently (model::concurrentPool()),
+        and nothing is profiled, the nodes are a task graph: each one
+        starts as soon as its children are evaluated, so independent
+        formulas, and independent operands of one formula, run side by
+        side; of the nodes ready, the one heading the costliest chain
+        of operations still to run starts first. Otherwise, the ids are
+        evaluated one at a time, in order. Either way, the results and
+        the releases are those of evaluate().
+    */
+    void evaluateAll(const std::vector<int>& ids);
+
+    /// One more use of node id, still to be read.
+    void retain(int id);
+
+    /// A use of node id is over; its result is freed with the last one.
+    void release(int id);
+
+    /**
+        Bring the evaluated nodes up to date after the model changed;
+        the sets of the changed labels were changed in place. A node is
+        computed again only if the arcs changed and its operator is
+        temporal, or one of its children's sets changed. E p U q and
+        EF q start from their earlier result when the change can only
+        make them grow, and AG p when it can only make it shrink.
+        Nodes not evaluated yet are left so.
+    */
+    void update(const model_delta& d);
+
+    /// Record every operation evaluate() runs into p, or nothing if p is 0.
+    void setProfile(op_profile* p) { profile = p; }
+
+  private:
+    struct key {
+      int op, a, b;
+      bool operator==(const key& k) const { return op == k.op && a == k.a && b == k.b; }
+    };
+    struct key_hash {
+      size_t operator()(const key& k) const {
+        return (size_t(k.op) * 0x9E3779B97F4A7C15ull) ^ (size_t(k.a) * 0xC2B2AE3D27D4EB4Full) ^ size_t(k.b);
+      }
+    };
+
+    enum change { SAME, GREW, SHRANK, CHANGED };
+    struct schedule;
+
+    int find(ctl_opcode op, int a, int b);
+    void releaseChildren(int id);
+    change compare(const state_set* before, const state_set* after);
+    template <class F> void timed(ctl_opcode op, const state_set* sset1, const state_set* sset2,
+      const state_set* rset, const F& body);
+    void run(ctl_opcode op, const state_set* sset1, const state_set* sset2, state_set* rset);
+    void start(schedule& s, std::vector<int>& ready);
+    void runTask(schedule& s, int id);
+
+    model* m;
+    op_profile* profile;
+    std::vector<node> nodes;
+    std::unordered_map<key, int, key_hash> unique;
+};
+
+#endif
@@ -0,0 +1,67 @@
+
+#include "input_buffer.h"
+
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+input_buffer::input_buffer()
+: data(""), len(0), mapped(0)
+{
+}
+
+input_buffer::~input_buffer()
+{
+  release();
+}
+
+void input_buffer::release()
+{
+  if (mapped) munmap(mapped, len);
+  mapped = 0;
+  std::vector<char>().swap(buf);
+  data = "";
+  len = 0;
+}
+
+bool input_buffer::open(const char* path)
+{
+  release();
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      madvise(p, st.st_size, MADV_SEQUENTIAL);
+      mapped = p;
+      data = static_cast<const char*>(p);
+      len = st.st_size;
+      close(fd);
+      return true;
+    }
+  }
+  close(fd);
+
+  // not a regular file, or empty, or not mappable
+  std::ifstream in(path, std::ios::binary);
+  if (in.fail()) return false;
+  read(in);
+  return true;
+}
+
+void input_buffer::read(std::istream& in)
+{
+  release();
+  char chunk[1 << 16];
+  while (in.read(chunk, sizeof(chunk)) || in.gcount() > 0) {
+    buf.insert(buf.end(), chunk, chunk + in.gcount());
+  }
+  if (!buf.empty()) {
+    data = &buf[0];
+    len = buf.size();
+  }
+}
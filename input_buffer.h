@@ -0,0 +1,43 @@
+#ifndef __INPUT_BUFFER_H__
+#define __INPUT_BUFFER_H__
+
+#include <cstddef>
+#include <istream>
+#include <vector>
+
+/**
+  The whole input, as one read-only block of memory.
+
+  A regular file is mapped with mmap, so its bytes are never copied:
+  the kernel pages them in as the parser walks through them. Anything
+  that cannot be mapped (standard input, a pipe) is read into a buffer
+  owned by this object instead.
+*/
+class input_buffer {
+  public:
+    input_buffer();
+    ~input_buffer();
+
+    /// Map (or, failing that, read) a file; false if it cannot be opened.
+    bool open(const char* path);
+
+    /// Read a stream to its end.
+    void read(std::istream& in);
+
+    const char* begin() const { return data; }
+    const char* end() const { return data + len; }
+    size_t size() const { return len; }
+
+  private:
+    input_buffer(const input_buffer&);
+    input_buffer& operator=(const input_buffer&);
+
+    void release();
+
+    const char* data;
+    size_t len;
+    void* mapped;             // mmap'ed region, or 0
+    std::vector<char> buf;    // contents, when not mapped
+};
+
+#endif
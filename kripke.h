@@ -0,0 +1,100 @@
+#ifndef __KRIPKE_H__
+#define __KRIPKE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+class model;
+class state_set;
+struct parse_state;
+
+typedef int state_id;
+
+// what a kripke_context call returns
+typedef enum {
+  KRIPKE_OK=0,
+  KRIPKE_SYNTAX_ERROR,    // the input or a formula does not parse
+  KRIPKE_BAD_MODEL,       // arcs outside the states, a state without arcs, or a bad .ksb image
+  KRIPKE_NO_MODEL,        // no model was loaded, or it could not be created
+  KRIPKE_UNKNOWN_LABEL,   // neither in the LABELS section nor assigned a formula
+  KRIPKE_BAD_STATE        // not a state of the model
+} kripke_status;
+
+/**
+  The model checker as a library (libkripke.a): a context owns a model,
+  its labels and its CTL formulas, with the same input format, formula
+  DAG and labeling operations as mctool.
+
+  A call never exits and never writes to standard output: it returns a
+  status, and error() says what went wrong. A context is used by one
+  thread at a time; different contexts may be used from different
+  threads at the same time, as they share nothing.
+
+  Formulas are evaluated when a result is first read, and their sets,
+  like those of every subformula, are kept for the calls that follow.
+*/
+class kripke_context {
+  public:
+    /**
+        @param  num_threads   for the labeling operations, as mctool -j
+        @param  symbolic      use the BDD model, as mctool -b
+    */
+    kripke_context(int num_threads = 1, bool symbolic = false);
+    ~kripke_context();
+
+    /**
+        Load a model from an input in the format of mctool, the bytes
+        [begin, end), replacing the model loaded before, if any. The
+        input goes on to the CTL keyword, at least; the assignments of
+        the CTL section are added as by define(), and its queries are
+        ignored.
+    */
+    kripke_status load(const char* begin, const char* end);
+
+    /**
+        Load a model, and its labels, from a .ksb image in memory (see
+        ksb.h), which must stay there as long as the model is loaded.
+    */
+    kripke_status loadKSB(const void* data, size_t size);
+
+    /// label := formula, as in a CTL section.
+    kripke_status define(const char* label, const char* formula);
+
+    /// Evaluate label on every state, unless it already was.
+    kripke_status evaluate(const char* label);
+
+    /// Does state s satisfy label?
+    kripke_status holds(state_id s, const char* label, bool& result);
+
+    /// The states that satisfy label, in increasing order.
+    kripke_status states(const char* label, std::vector<state_id>& result);
+
+    /// The states that satisfy label, as bit s % 64 of words[s / 64].
+    kripke_status bits(const char* label, std::vector<uint64_t>& words);
+
+    /// Number of states of the model, 0 if none is loaded.
+    int numStates() const;
+
+    /// What went wrong in the last call that did not return KRIPKE_OK.
+    const std::string& error() const { return message; }
+
+  private:
+    kripke_context(const kripke_context&);
+    kripke_context& operator=(const kripke_context&);
+
+    void clear();
+    kripke_status fail(kripke_status status, const std::string& why);
+    kripke_status lookup(const char* label, const state_set*& sset);
+
+    int num_threads;
+    bool symbolic;
+    model* m;
+    parse_state* state;
+    std::ostringstream log;     // what the parser and the model report
+    std::string message;
+};
+
+#endif
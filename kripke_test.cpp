@@ -0,0 +1,112 @@
+/**
+    Checks of the library interface, kripke.h: make check builds and
+    runs them against libkripke.a. Each failed check prints a line;
+    the exit status is the number of them.
+*/
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "kripke.h"
+#include "ksb.h"
+
+using namespace std;
+
+int failures = 0;
+
+void expect(bool ok, const string& what, const kripke_context& k)
+{
+  if (ok) return;
+  cout << "FAILED: " << what << " (" << k.error() << ")" << endl;
+  failures++;
+}
+
+// a .ksb image of g, with one label p, whose first word is p_word
+string ksb_image(const kripke_graph& g, uint64_t p_word)
+{
+  const char* path = "kripke_test.ksb";
+  state_set p(g.num_states);
+  p.makeDense();
+  p.data()[0] = p_word;
+  vector<string> names(1, "p");
+  vector<const state_set*> sets(1, &p);
+  string error;
+  if (!writeKSB(path, g, names, sets, error)) cout << error << endl;
+  ifstream in(path, ios::binary);
+  stringstream image;
+  image << in.rdbuf();
+  remove(path);
+  return image.str();
+}
+
+// loadKSB() of a .ksb image with a valid checksum
+kripke_status load_image(kripke_context& k, const string& image)
+{
+  return k.loadKSB(image.data(), image.size());
+}
+
+int main()
+{
+  const string input =
+    "KRIPKE\n"
+    "STATES 3\n"
+    "ARCS S0 -> S1; S1 -> S0; S2 -> S2;\n"
+    "LABELS a: S0;\n"
+    "CTL\n"
+    "  f := EX a;\n";
+
+  kripke_context k;
+  expect(k.load(input.data(), input.data() + input.size()) == KRIPKE_OK, "load", k);
+
+  // a define that fails declares nothing
+  vector<state_id> states;
+  bool result;
+  expect(k.define("bad", "EX (a &") == KRIPKE_SYNTAX_ERROR, "define bad := EX (a &", k);
+  expect(k.states("bad", states) == KRIPKE_UNKNOWN_LABEL, "states of bad after a failed define", k);
+  expect(k.holds(0, "bad", result) == KRIPKE_UNKNOWN_LABEL, "holds of bad after a failed define", k);
+
+  // nor changes a label defined before
+  expect(k.define("f", "EX (a &") == KRIPKE_SYNTAX_ERROR, "define f := EX (a &", k);
+  expect(k.states("f", states) == KRIPKE_OK && states == vector<state_id>(1, 1),
+    "f is still EX a after a failed define", k);
+
+  // and the label can still be defined
+  expect(k.define("bad", "EG !a") == KRIPKE_OK, "define bad := EG !a", k);
+  expect(k.holds(2, "bad", result) == KRIPKE_OK && result, "S2 |= bad", k);
+
+  // .ksb images must be as finish() would build the model, whatever
+  // their checksum: S0 -> S1, S1 -> S2, S2 -> S0, and p on S1
+  int succ_off[] = { 0, 1, 2, 3 }, succ[] = { 1, 2, 0 };
+  int pred_off[] = { 0, 1, 2, 3 }, pred[] = { 2, 0, 1 };
+  kripke_graph g = { 3, 3, succ_off, succ, pred_off, pred };
+  string image = ksb_image(g, 2);
+  expect(load_image(k, image) == KRIPKE_OK, "loadKSB of a valid image", k);
+  expect(k.holds(1, "p", result) == KRIPKE_OK && result, "S1 |= p in a .ksb image", k);
+
+  // S1 has no successor
+  int dead_succ_off[] = { 0, 1, 1, 2 }, dead_succ[] = { 1, 0 };
+  int dead_pred_off[] = { 0, 1, 2, 2 }, dead_pred[] = { 2, 0 };
+  kripke_graph dead = { 3, 2, dead_succ_off, dead_succ, dead_pred_off, dead_pred };
+  expect(load_image(k, ksb_image(dead, 2)) == KRIPKE_BAD_MODEL, "loadKSB of a state without successors", k);
+
+  // S0 -> S1 twice
+  int dup_succ_off[] = { 0, 2, 3, 4 }, dup_succ[] = { 1, 1, 2, 0 };
+  int dup_pred_off[] = { 0, 1, 3, 4 }, dup_pred[] = { 2, 0, 0, 1 };
+  kripke_graph dup = { 3, 4, dup_succ_off, dup_succ, dup_pred_off, dup_pred };
+  expect(load_image(k, ksb_image(dup, 2)) == KRIPKE_BAD_MODEL, "loadKSB of a repeated arc", k);
+
+  // pred is not the transpose of succ
+  int bad_pred[] = { 1, 0, 2 };
+  kripke_graph transposed = { 3, 3, succ_off, succ, pred_off, bad_pred };
+  expect(load_image(k, ksb_image(transposed, 2)) == KRIPKE_BAD_MODEL, "loadKSB of a wrong pred", k);
+
+  // p has bit 40, past the last state
+  expect(load_image(k, ksb_image(g, 2 | uint64_t(1) << 40)) == KRIPKE_BAD_MODEL,
+    "loadKSB of a label with a bit past the last state", k);
+
+  return failures;
+}
@@ -0,0 +1,247 @@
+
+#include "ksb.h"
+
+#include <cstdio>
+#include <cstring>
+
+static const char KSB_MAGIC[8] = { 'K', 'R', 'I', 'P', 'K', 'E', 'B', 0 };
+static const uint32_t KSB_BYTE_ORDER = 0x01020304;
+
+static uint64_t pad8(uint64_t n) { return (n + 7) & ~uint64_t(7); }
+
+/*
+  Checksum of a sequence of 8-byte words, fed in any number of pieces.
+  Four independent lanes, so that checking a large file runs at memory
+  speed rather than at the latency of one multiply per word.
+*/
+class ksb_checksum {
+    uint64_t lane[4];
+    uint64_t count;
+  public:
+    ksb_checksum() : count(0) {
+      for (int i = 0; i < 4; i++) lane[i] = 0x9E3779B97F4A7C15ull * (i + 1);
+    }
+
+    // len must be a multiple of 8
+    void add(const void* data, size_t len) {
+      const char* p = static_cast<const char*>(data);
+      for (size_t i = 0; i < len; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        uint64_t& h = lane[count++ & 3];
+        h = (h ^ w) * 0x100000001B3ull;
+        h ^= h >> 29;
+      }
+    }
+
+    uint64_t value() const {
+      uint64_t h = count;
+      for (int i = 0; i < 4; i++) h = (h ^ lane[i]) * 0xC2B2AE3D27D4EB4Full;
+      return h ^ (h >> 32);
+    }
+};
+
+// Section offsets and file size of h, given its counts and the size of the label names.
+static void layout(ksb_header& h, uint64_t names_bytes)
+{
+  uint64_t at = pad8(sizeof(ksb_header));
+  h.succ_off = at;      at += pad8(4 * (uint64_t(h.num_states) + 1));
+  h.succ = at;          at += pad8(4 * uint64_t(h.num_arcs));
+  h.pred_off = at;      at += pad8(4 * (uint64_t(h.num_states) + 1));
+  h.pred = at;          at += pad8(4 * uint64_t(h.num_arcs));
+  h.label_names = at;   at += pad8(names_bytes);
+  h.label_sets = at;    at += 8 * uint64_t(h.words_per_set) * h.num_labels;
+  h.file_size = at;
+}
+
+bool isKSB(const char* data, size_t len)
+{
+  return len >= sizeof(KSB_MAGIC) && memcmp(data, KSB_MAGIC, sizeof(KSB_MAGIC)) == 0;
+}
+
+// Write len bytes and the zeros up to the next multiple of 8.
+static bool writePadded(FILE* f, const void* data, uint64_t len, ksb_checksum& sum)
+{
+  uint64_t full = len & ~uint64_t(7);
+  if (full) {
+    if (fwrite(data, 1, full, f) != full) return false;
+    sum.add(data, full);
+  }
+  if (len > full) {
+    char last[8] = { 0 };
+    memcpy(last, static_cast<const char*>(data) + full, len - full);
+    if (fwrite(last, 1, 8, f) != 8) return false;
+    sum.add(last, 8);
+  }
+  return true;
+}
+
+bool writeKSB(const char* path, const kripke_graph& g,
+    const std::vector<std::string>& names,
+    const std::vector<const state_set*>& sets, std::string& error)
+{
+  ksb_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, KSB_MAGIC, sizeof(KSB_MAGIC));
+  h.version = KSB_VERSION;
+  h.byte_order = KSB_BYTE_ORDER;
+  h.num_states = g.num_states;
+  h.num_arcs = g.num_arcs;
+  h.num_labels = names.size();
+  h.words_per_set = (g.num_states + state_set::WORD_BITS - 1) / state_set::WORD_BITS;
+
+  std::string name_buf;
+  for (size_t i = 0; i < names.size(); i++) {
+    uint32_t len = names[i].size();
+    name_buf.append(reinterpret_cast<const char*>(&len), 4);
+    name_buf.append(names[i]);
+  }
+  layout(h, name_buf.size());
+
+  FILE* f = fopen(path, "wb");
+  if (0 == f) {
+    error = "cannot create " + std::string(path);
+    return false;
+  }
+  ksb_checksum sum;
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+    && writePadded(f, g.succ_off, 4 * (uint64_t(g.num_states) + 1), sum)
+    && writePadded(f, g.succ, 4 * uint64_t(g.num_arcs), sum)
+    && writePadded(f, g.pred_off, 4 * (uint64_t(g.num_states) + 1), sum)
+    && writePadded(f, g.pred, 4 * uint64_t(g.num_arcs), sum)
+    && writePadded(f, name_buf.data(), name_buf.size(), sum);
+  std::vector<state_set::word> words(h.words_per_set);
+  for (size_t i = 0; ok && i < sets.size(); i++) {
+    if (sets[i]->size() != g.num_states) {
+      fclose(f);
+      error = "label " + names[i] + " is not a set of explicit states";
+      return false;
+    }
+    sets[i]->toWords(words.data());
+    ok = writePadded(f, words.data(), 8 * uint64_t(h.words_per_set), sum);
+  }
+
+  // now that the checksum is known, write the header again
+  h.checksum = sum.value();
+  ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1;
+  ok = (fclose(f) == 0) && ok;
+  if (!ok) error = "error writing " + std::string(path);
+  return ok;
+}
+
+/*
+  The arrays are used in place by the labeling operations, which trust
+  them to be as finish() builds them; a checksum only catches accidents.
+  So check that the offsets run from 0 to num_arcs without decreasing,
+  that every state has successors, in increasing order and without
+  repeats, and that pred is the transpose of succ: the predecessors of
+  every state, in increasing order.
+*/
+static bool validAdjacency(const kripke_graph& g)
+{
+  int n = g.num_states;
+  if (g.succ_off[0] != 0 || g.succ_off[n] != g.num_arcs
+      || g.pred_off[0] != 0 || g.pred_off[n] != g.num_arcs) return false;
+  for (int s = 0; s < n; s++) {
+    if (g.succ_off[s] >= g.succ_off[s+1] || g.succ_off[s+1] > g.num_arcs
+        || g.pred_off[s] > g.pred_off[s+1] || g.pred_off[s+1] > g.num_arcs) return false;
+  }
+
+  // the arcs s -> t by increasing s must meet the predecessors of each t
+  // in order; next[t] is where the next one must be
+  std::vector<int> next(g.pred_off, g.pred_off + n);
+  for (int s = 0; s < n; s++) {
+    for (int k = g.succ_off[s]; k < g.succ_off[s+1]; k++) {
+      int t = g.succ[k];
+      if (unsigned(t) >= unsigned(n)) return false;
+      if (k > g.succ_off[s] && t <= g.succ[k-1]) return false;
+      if (next[t] == g.pred_off[t+1] || g.pred[next[t]] != s) return false;
+      next[t]++;
+    }
+  }
+  return true;    // num_arcs predecessors met: all of them
+}
+
+ksb_reader::ksb_reader()
+: words_per_set(0), sets(0)
+{
+  memset(&g, 0, sizeof(g));
+}
+
+bool ksb_reader::open(const char* data, size_t len, std::string& error)
+{
+  ksb_header h;
+  if (!isKSB(data, len) || len < sizeof(h)) {
+    error = "not a .ksb file";
+    return false;
+  }
+  memcpy(&h, data, sizeof(h));
+  if (h.version != KSB_VERSION) {
+    error = "unsupported .ksb version";
+    return false;
+  }
+  if (h.byte_order != KSB_BYTE_ORDER) {
+    error = ".ksb file written with another byte order";
+    return false;
+  }
+
+  // the offsets must be exactly where the counts put them
+  ksb_header expected = h;
+  if (h.num_states < 0 || h.num_arcs < 0 || h.num_labels < 0
+      || h.words_per_set != (h.num_states + state_set::WORD_BITS - 1) / state_set::WORD_BITS
+      || h.label_sets < h.label_names) {
+    error = "corrupt .ksb header";
+    return false;
+  }
+  layout(expected, h.label_sets - h.label_names);
+  if (memcmp(&expected, &h, sizeof(h)) != 0 || h.file_size != len) {
+    error = "corrupt or truncated .ksb file";
+    return false;
+  }
+  ksb_checksum sum;
+  sum.add(data + h.succ_off, len - h.succ_off);
+  if (sum.value() != h.checksum) {
+    error = ".ksb checksum mismatch";
+    return false;
+  }
+
+  g.num_states = h.num_states;
+  g.num_arcs = h.num_arcs;
+  g.succ_off = reinterpret_cast<const int*>(data + h.succ_off);
+  g.succ = reinterpret_cast<const int*>(data + h.succ);
+  g.pred_off = reinterpret_cast<const int*>(data + h.pred_off);
+  g.pred = reinterpret_cast<const int*>(data + h.pred);
+  if (!validAdjacency(g)) {
+    error = "corrupt .ksb adjacency";
+    return false;
+  }
+
+  names.clear();
+  const char* p = data + h.label_names;
+  const char* end = data + h.label_sets;
+  for (int i = 0; i < h.num_labels; i++) {
+    uint32_t n;
+    if (end - p < 4) break;
+    memcpy(&n, p, 4);
+    p += 4;
+    if (uint64_t(end - p) < n) break;
+    names.push_back(std::string(p, n));
+    p += n;
+  }
+  if ((int) names.size() != h.num_labels) {
+    error = "corrupt .ksb label names";
+    return false;
+  }
+  words_per_set = h.words_per_set;
+  sets = reinterpret_cast<const uint64_t*>(data + h.label_sets);
+
+  // the bits past the last state are zero, as in a state_set
+  int tail = h.num_states % state_set::WORD_BITS;
+  for (int i = 0; tail && i < h.num_labels; i++) {
+    if (labelWords(i)[words_per_set - 1] >> tail) {
+      error = "corrupt .ksb label sets";
+      return false;
+    }
+  }
+  return true;
+}
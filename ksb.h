@@ -0,0 +1,89 @@
+#ifndef __KSB_H__
+#define __KSB_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "model.h"
+
+/**
+  Binary Kripke structure files (.ksb).
+
+  A .ksb file holds a finished Kripke structure and its labels, laid
+  out so that it can be mapped and used in place:
+
+    header        ksb_header below
+    succ_off      int32[num_states+1]
+    succ          int32[num_arcs]
+    pred_off      int32[num_states+1]
+    pred          int32[num_arcs]
+    label names   for each label, a uint32 length and the characters
+    label sets    for each label, uint64[words_per_set]: a bitset in
+                  the layout of state_set
+
+  Every section starts at a multiple of 8 bytes. Integers are in the
+  byte order of the machine that wrote the file, and a file written
+  with another byte order is rejected. The checksum covers everything
+  after the header. As the arrays are used in place, a reader also
+  checks that they are as model::finish() would build them: offsets
+  that never decrease, successors of every state, increasing and
+  without repeats, and pred the transpose of succ; and that no label
+  has a bit past the last state.
+*/
+
+const unsigned KSB_VERSION = 1;
+
+struct ksb_header {
+  char magic[8];              // "KRIPKEB" and a NUL
+  uint32_t version;
+  uint32_t byte_order;        // 0x01020304 as written
+  uint64_t file_size;
+  uint64_t checksum;
+  int32_t num_states;
+  int32_t num_arcs;
+  int32_t num_labels;
+  int32_t words_per_set;
+  uint64_t succ_off, succ, pred_off, pred;    // section offsets in the file
+  uint64_t label_names, label_sets;
+};
+
+/// True iff the bytes start like a .ksb file.
+bool isKSB(const char* data, size_t len);
+
+/**
+  Write a structure and its labels; sets[i] holds the states of
+  names[i], and must be a state_set of the model g comes from
+  (in either form).
+  Returns false, with a message in error, if the file cannot be written.
+*/
+bool writeKSB(const char* path, const kripke_graph& g,
+    const std::vector<std::string>& names,
+    const std::vector<const state_set*>& sets, std::string& error);
+
+/**
+  A .ksb file, read in place from memory (usually, a mapped file).
+  Nothing is copied: the memory must outlive this object and any model
+  built from graph().
+*/
+class ksb_reader {
+  public:
+    ksb_reader();
+
+    /// Check the file in [data, data+len); false, with a message in error, if it is not valid.
+    bool open(const char* data, size_t len, std::string& error);
+
+    const kripke_graph& graph() const { return g; }
+    int numLabels() const { return names.size(); }
+    const std::string& labelName(int i) const { return names[i]; }
+    int wordsPerSet() const { return words_per_set; }
+    const uint64_t* labelWords(int i) const { return sets + size_t(i) * words_per_set; }
+
+  private:
+    kripke_graph g;
+    std::vector<std::string> names;
+    int words_per_set;
+    const uint64_t* sets;
+};
+
+#endif
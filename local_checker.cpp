@@ -0,0 +1,167 @@
+#include "local_checker.h"
+#include "formula_dag.h"
+#include "op_profile.h"
+
+#include <cassert>
+#include <chrono>
+
+local_checker::local_checker(model* a_model, formula_dag* a_dag, const kripke_graph& a_graph)
+: m(a_model), dag(a_dag), g(a_graph), profile(0), counters(0)
+{
+}
+
+bool local_checker::check(int id, state_id s)
+{
+  if (0 == profile) return holds(id, s);
+
+  op_profile::call c;
+  c.op = "local";
+  c.in1 = c.in2 = -1;
+  counters = &c.work;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  bool v = holds(id, s);
+  c.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  counters = 0;
+  c.out = v;
+  profile->add(c);
+  return v;
+}
+
+// -1 if unknown, else the verdict
+int local_checker::lookup(int id, state_id s) const
+{
+  std::unordered_map<unsigned long long, bool>::const_iterator i
+    = verdicts.find((unsigned long long) id << 32 | unsigned(s));
+  return (i == verdicts.end()) ? -1 : i->second;
+}
+
+void local_checker::record(int id, state_id s, bool v)
+{
+  verdicts[(unsigned long long) id << 32 | unsigned(s)] = v;
+}
+
+bool local_checker::holds(int id, state_id s)
+{
+  const formula_dag::node& n = dag->get(id);
+  if (n.result) return m->elementOf(s, n.result);
+  int known = lookup(id, s);
+  if (known >= 0) return known;
+
+  bool v = false;
+  switch (n.op) {
+    case OP_NOT:      v = !holds(n.a, s);                     break;
+    case OP_AND:      v = holds(n.a, s) && holds(n.b, s);     break;
+    case OP_OR:       v = holds(n.a, s) || holds(n.b, s);     break;
+    case OP_IMPLIES:  v = !holds(n.a, s) || holds(n.b, s);    break;
+    case OP_EX:
+    case OP_AX: {
+      // EX: some successor in a; AX: none outside a
+      bool all = n.op == OP_AX;
+      v = all;
+      for (int k = g.succ_off[s]; k < g.succ_off[s+1] && v == all; k++) {
+        if (counters) counters->arcs++;
+        if (holds(n.a, g.succ[k]) != all) v = !all;
+      }
+      break;
+    }
+    case OP_EF:       v = until(id, -1, n.a, s, false);       break;
+    case OP_EU:       v = until(id, n.a, n.b, s, false);      break;
+    case OP_AF:       v = until(id, -1, n.a, s, true);        break;
+    case OP_AU:       v = until(id, n.a, n.b, s, true);       break;
+    case OP_EG:       v = globally(id, n.a, s, false);        break;
+    case OP_AG:       v = globally(id, n.a, s, true);         break;
+    default:          assert(0);
+  }
+  record(id, s, v);
+  return v;
+}
+
+/*
+  Depth-first search from s for a state that decides node id, with an
+  explicit stack, so that long paths cannot overflow the machine stack.
+  visit(t, mark) classifies each state reached: FOUND ends the search,
+  and every state on the stack, from s to t, gets the verdict found;
+  PUSH explores t's successors; SKIP goes on with the next arc. If the
+  search ends without FOUND, every state it pushed gets !found. With
+  known_when_done, a state gets !found as soon as its successors are
+  explored.
+*/
+template <class F>
+bool local_checker::search(int id, state_id s, bool found, bool known_when_done, const F& visit)
+{
+  std::unordered_map<state_id, mark> seen;
+  std::vector<std::pair<state_id, int> > stack;   // state, and next arc to follow
+
+  step first = visit(s, NONE);
+  if (first != PUSH) return (first == FOUND) == found;
+  seen[s] = ON_STACK;
+  stack.push_back(std::make_pair(s, g.succ_off[s]));
+  if (counters) counters->iterations++;
+
+  while (!stack.empty()) {
+    state_id v = stack.back().first;
+    if (stack.back().second == g.succ_off[v+1]) {
+      // all arcs of v followed
+      stack.pop_back();
+      seen[v] = DONE;
+      if (known_when_done) record(id, v, !found);
+      continue;
+    }
+    state_id t = g.succ[stack.back().second++];
+    if (counters) counters->arcs++;
+
+    std::unordered_map<state_id, mark>::iterator i = seen.find(t);
+    step next = visit(t, (i == seen.end()) ? NONE : i->second);
+    if (next == FOUND) {
+      record(id, t, found);
+      for (size_t k = 0; k < stack.size(); k++) record(id, stack[k].first, found);
+      return found;
+    }
+    if (next == PUSH) {
+      seen[t] = ON_STACK;
+      stack.push_back(std::make_pair(t, g.succ_off[t]));
+      if (counters) counters->iterations++;
+    }
+  }
+
+  // every state the search can reach was explored
+  for (std::unordered_map<state_id, mark>::iterator i = seen.begin(); i != seen.end(); ++i) {
+    record(id, i->first, !found);
+  }
+  return !found;
+}
+
+/*
+  E p U q (all false) and A p U q (all true); p is -1 for EF q and AF q.
+  E: look for a path of p-states to a q-state.
+  A: look for a path of p-states, none in q, to a state outside p, or
+  to a cycle; a state all of whose successors are explored without
+  finding one satisfies A p U q.
+*/
+bool local_checker::until(int id, int p, int q, state_id s, bool all)
+{
+  return search(id, s, !all, all, [&](state_id t, mark seen) -> step {
+    int known = lookup(id, t);
+    if (known >= 0) return (known == !all) ? FOUND : SKIP;
+    if (seen != NONE) return (all && seen == ON_STACK) ? FOUND : SKIP;
+    if (holds(q, t)) return all ? SKIP : FOUND;
+    if (!holdsOrTrue(p, t)) return all ? FOUND : SKIP;
+    return PUSH;
+  });
+}
+
+/*
+  EG p (all false): look for a cycle of p-states, reached by a path of
+  p-states. AG p (all true): look for a state outside p, reached by a
+  path of p-states.
+*/
+bool local_checker::globally(int id, int p, state_id s, bool all)
+{
+  return search(id, s, !all, false, [&](state_id t, mark seen) -> step {
+    int known = lookup(id, t);
+    if (known >= 0) return (known == !all) ? FOUND : SKIP;
+    if (seen != NONE) return (!all && seen == ON_STACK) ? FOUND : SKIP;
+    if (!holds(p, t)) return all ? FOUND : SKIP;
+    return PUSH;
+  });
+}
@@ -0,0 +1,60 @@
+#ifndef __LOCAL_CHECKER_H__
+#define __LOCAL_CHECKER_H__
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "model.h"
+
+class formula_dag;
+class op_profile;
+
+/**
+  Local (on-the-fly) model checking: whether one state satisfies a node
+  of a formula_dag, found by exploring the graph from that state only.
+
+  Boolean connectives and EX, AX are decided from the state and its
+  successors. The other temporal operators are depth-first searches
+  over the states the formula can reach from it, which stop as soon as
+  the answer is known: a witness path of E p U q or EF q, a lasso of
+  EG p, a counterexample of A p U q, AF q or AG p. The verdict of every
+  state a search settles is kept, per node, for the searches and the
+  queries that follow.
+
+  A node the dag has already evaluated on every state (labels, and
+  results kept from earlier queries) is read from its set instead.
+  The model must give its arcs with getGraph().
+*/
+class local_checker {
+  public:
+    local_checker(model* m, formula_dag* dag, const kripke_graph& g);
+
+    /// Does state s satisfy dag node id?
+    bool check(int id, state_id s);
+
+    /// Record every check() into p as one call, or nothing if p is 0.
+    void setProfile(op_profile* p) { profile = p; }
+
+  private:
+    enum step { SKIP, PUSH, FOUND };
+    enum mark { NONE, ON_STACK, DONE };
+
+    bool holds(int id, state_id s);
+    bool holdsOrTrue(int id, state_id s) { return id < 0 || holds(id, s); }
+    int lookup(int id, state_id s) const;
+    void record(int id, state_id s, bool v);
+
+    template <class F> bool search(int id, state_id s, bool found, bool known_when_done, const F& visit);
+    bool until(int id, int p, int q, state_id s, bool all);
+    bool globally(int id, int p, state_id s, bool all);
+
+    model* m;
+    formula_dag* dag;
+    kripke_graph g;
+    op_profile* profile;
+    op_counters* counters;    // of the check() being profiled, or 0
+    std::unordered_map<unsigned long long, bool> verdicts;   // by node and state
+};
+
+#endif
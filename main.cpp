@@ -0,0 +1,268 @@
+
+#include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <cstring>
+
+#include "parser.h"
+#include "input_buffer.h"
+#include "ksb.h"
+
+using namespace std;
+
+int usage(const char* who)
+{
+  cout << "\nUsage: " << who << " [-h] [-d debug_level] [-j threads] [-b] [-a] [-l] [-o model.ksb]\n"
+       << "\t[-u delta-file]... [--serve [--socket path]] [input-file | model.ksb [ctl-file]]\n"
+       << "   or: " << who << " [options] --batch [--manifest list] [--outdir dir] [input-file]...\n\n";
+  cout << "\t-h: display this help screen\n\n";
+  cout << "\t-d: specify the debug level; a level of 0 (the default)\n";
+  cout << "\t    should not display any debugging information.\n";
+  cout << "\t    1 writes the time and work of the labeling operations\n";
+  cout << "\t    of each CTL formula to standard error, as a table;\n";
+  cout << "\t    2 writes every operation as a line of JSON\n\n";
+  cout << "\t-j: number of threads used by the labeling operations;\n";
+  cout << "\t    1 (the default) is single threaded; with more, the\n";
+  cout << "\t    formulas that do not depend on each other are also\n";
+  cout << "\t    evaluated at the same time\n\n";
+  cout << "\t-b: use the symbolic model, which stores the transition\n";
+  cout << "\t    relation and the sets of states as BDDs\n\n";
+  cout << "\t-a: evaluate every CTL assignment, even those no\n";
+  cout << "\t    S |= p or [[ p ]] query needs; by default only the\n";
+  cout << "\t    formulas the queries need are evaluated\n\n";
+  cout << "\t-l: answer each S |= p query by a search from state S,\n";
+  cout << "\t    which stops as soon as the answer is known, instead\n";
+  cout << "\t    of computing p on every state (explicit model only)\n\n";
+  cout << "\t-o: once the labels are read, save the Kripke structure\n";
+  cout << "\t    and its labels as a binary .ksb file\n\n";
+  cout << "\t-u: once the results are shown, apply the changes to the\n";
+  cout << "\t    arcs and labels given in delta-file, and show them\n";
+  cout << "\t    again, recomputing only what the changes affect;\n";
+  cout << "\t    may be given more than once, applied in order\n\n";
+  cout << "\t--serve: once the input is done, keep the model and the\n";
+  cout << "\t    results computed so far, and answer more statements\n";
+  cout << "\t    of the CTL section (p := formula; S |= p; [[ p ]];)\n";
+  cout << "\t    read from standard input, one line of reply each;\n";
+  cout << "\t    the input file must then be given\n\n";
+  cout << "\t--socket: with --serve, read the statements from the\n";
+  cout << "\t    clients of a Unix domain socket created at path\n\n";
+  cout << "\t--batch: check each input file given, with a model and\n";
+  cout << "\t    labels of its own, several at a time on the -j threads\n";
+  cout << "\t    (all the cores by default); the results are written\n";
+  cout << "\t    in the order of the files, each under a \"file:\" line\n\n";
+  cout << "\t--manifest: with --batch, also check the files listed\n";
+  cout << "\t    in list, one per line\n\n";
+  cout << "\t--outdir: with --batch, write the results of input-file\n";
+  cout << "\t    to dir/input-file.out instead of standard output\n\n";
+  cout << "\tIf an input file is not specified, then the input file is\n";
+  cout << "\tread from standard input.\n\n";
+  cout << "\tA .ksb file replaces the KRIPKE, STATES, ARCS and LABELS\n";
+  cout << "\tsections; the rest (the CTL section, optionally preceded\n";
+  cout << "\tby more labels) is read from ctl-file, or from standard input.\n\n";
+  return 1;
+}
+
+int main(int argc, const char *argv[])
+{
+  const char* fn = 0;
+  const char* ctl_fn = 0;
+  model* m = 0;
+  mc_options opts;
+  bool threads_given = false;
+  bool batch = false;
+  vector<const char*> batch_files;
+  vector<string> manifest_files;
+  const char* manifest = 0;
+  const char* out_dir = 0;
+
+  //
+  // Process arguments, if any
+  //
+  for (int i=1; i<argc; i++) {
+
+    if (strcmp("-h", argv[i]) == 0) {
+      return usage(argv[0]);
+    }
+
+    if (strcmp("-d", argv[i]) == 0) {
+      i++;
+      if (i>=argc) return usage(argv[0]);
+      opts.debug_level = atoi(argv[i]);
+      continue;
+    }
+
+    if (strcmp("-j", argv[i]) == 0) {
+      i++;
+      if (i>=argc) return usage(argv[0]);
+      opts.num_threads = atoi(argv[i]);
+      if (opts.num_threads < 1) return usage(argv[0]);
+      threads_given = true;
+      continue;
+    }
+
+    if (strcmp("-b", argv[i]) == 0) {
+      opts.symbolic = true;
+      continue;
+    }
+
+    if (strcmp("-a", argv[i]) == 0) {
+      opts.evaluate_all = true;
+      continue;
+    }
+
+    if (strcmp("-l", argv[i]) == 0) {
+      opts.local = true;
+      continue;
+    }
+
+    if (strcmp("-o", argv[i]) == 0) {
+      i++;
+      if (i>=argc) return usage(argv[0]);
+      opts.export_file = argv[i];
+      continue;
+    }
+
+    if (strcmp("-u", argv[i]) == 0) {
+      i++;
+      if (i>=argc) return usage(argv[0]);
+      opts.updates.push_back(argv[i]);
+      continue;
+    }
+
+    if (strcmp("--serve", argv[i]) == 0) {
+      opts.serve = true;
+      continue;
+    }
+
+    if (strcmp("--socket", argv[i]) == 0) {
+      i++;
+      if (i>=argc) return usage(argv[0]);
+      opts.socket_path = argv[i];
+      continue;
+    }
+
+    if (strcmp("--batch", argv[i]) == 0) {
+      batch = true;
+      continue;
+    }
+
+    if (strcmp("--manifest", argv[i]) == 0) {
+      i++;
+      if (i>=argc) return usage(argv[0]);
+      manifest = argv[i];
+      continue;
+    }
+
+    if (strcmp("--outdir", argv[i]) == 0) {
+      i++;
+      if (i>=argc) return usage(argv[0]);
+      out_dir = argv[i];
+      continue;
+    }
+
+    if (batch) {
+      batch_files.push_back(argv[i]);
+      continue;
+    }
+    if (ctl_fn) return usage(argv[0]);
+    if (fn) ctl_fn = argv[i];
+    else fn = argv[i];
+  }
+  
+  if (opts.socket_path && !opts.serve) return usage(argv[0]);
+  if (opts.serve && !fn) return usage(argv[0]);   // standard input is for the statements
+
+  if ((manifest || out_dir) && !batch) return usage(argv[0]);
+
+  if (opts.debug_level) {
+    cout << "Using debug level " << opts.debug_level << endl;
+  }
+
+  if (batch) {
+    //
+    // Several input files, checked independently
+    //
+    if (opts.serve || opts.export_file || !opts.updates.empty()) return usage(argv[0]);
+    if (manifest) {
+      ifstream list(manifest);
+      if (!list) {
+        cout << "An error has occurred whilst opening "<< manifest << endl;
+        exit(0);
+      }
+      string line;
+      while (getline(list, line)) {
+        size_t b = line.find_first_not_of(" \t\r");
+        if (b == string::npos || line[b] == '#') continue;
+        manifest_files.push_back(line.substr(b, line.find_last_not_of(" \t\r") + 1 - b));
+      }
+      for (size_t k = 0; k < manifest_files.size(); k++) batch_files.push_back(manifest_files[k].c_str());
+    }
+    if (batch_files.empty()) return usage(argv[0]);
+    if (!threads_given) opts.num_threads = max(1u, thread::hardware_concurrency());
+    return check_files(opts, batch_files, out_dir) ? 1 : 0;
+  }
+
+  //
+  // Decide if input is file, or stdin
+  //
+
+  input_buffer source;
+  if (fn) {
+    //
+    // Filename specified: mapped, not read
+    //
+    if (!source.open(fn)) {
+      cout << "An error has occurred whilst opening "<< fn << endl;
+      exit(0);
+    }
+
+  } else {
+    //
+    // Read from standard input
+    //
+    source.read(cin);
+  }
+
+  ksb_reader ksb;
+  input_buffer ctl_source;
+  if (isKSB(source.begin(), source.size())) {
+    //
+    // Binary model: no parsing up to the CTL section
+    //
+    string error;
+    if (!ksb.open(source.begin(), source.size(), error)) {
+      cout << "Error: " << (fn ? fn : "standard input") << ": " << error << endl;
+      exit(1);
+    }
+    if (ctl_fn) {
+      if (!ctl_source.open(ctl_fn)) {
+        cout << "An error has occurred whilst opening "<< ctl_fn << endl;
+        exit(0);
+      }
+    } else if (opts.serve) {
+      // every statement comes from the server's clients
+      istringstream no_statements("CTL\n");
+      ctl_source.read(no_statements);
+    } else {
+      if (!fn) return usage(argv[0]);
+      ctl_source.read(cin);
+    }
+    m = load_ksb(opts, ksb);
+    if (m) m = parse_tokens(opts, m, ctl_source.begin(), ctl_source.end());
+
+  } else {
+    if (ctl_fn) return usage(argv[0]);
+    m = parse_tokens(opts, 0, source.begin(), source.end());
+  }
+
+  if (m) {
+    delete m;
+  } else {
+    cout << "Error, null model - did you rewrite function makeEmptyModel()?" << endl;
+  }
+}
+
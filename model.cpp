@@ -1,11 +1,14 @@
 
 #include "model.h"
+#include "scratch_arena.h"
+#include "thread_pool.h"
 #include <stdlib.h>
 #include <stdio.h>
-#include <set>
 #include <algorithm>
 #include <iterator>
+#include <mutex>
 #include <iostream>
+#include <vector>
 
 
 /*
@@ -16,21 +19,441 @@
 //Source state 
 
 typedef std::pair<state_id, state_id> pairs;
-typedef std::set<int> state_set;
+typedef state_set::word word;
 
-//class state_set : public std::set<state_id>{};
+// Bit of state s, and word holding it, in a state_set.
+#define BIT(s) (word(1) << ((s) % state_set::WORD_BITS))
+#define WORD(sset, s) ((sset)->data() + (s) / state_set::WORD_BITS)
+
+/*
+  Labels shared by the threads of a parallel fixpoint are read and
+  written with atomic operations; single threaded, with plain ones.
+*/
+
+// Is s in sset?
+static inline bool isLabelled(const state_set* sset, int s, bool atomic)
+{
+	const word* w = WORD(sset, s);
+	return ((atomic ? __atomic_load_n(w, __ATOMIC_RELAXED) : *w) & BIT(s)) != 0;
+}
+
+// Add s to sset; true iff s was not in sset before.
+static inline bool testAndSet(state_set* sset, int s, bool atomic)
+{
+	word* w = WORD(sset, s);
+	if(!atomic)
+	{
+		if(*w & BIT(s))
+			return false;
+		*w |= BIT(s);
+		return true;
+	}
+	return !(__atomic_fetch_or(w, BIT(s), __ATOMIC_RELAXED) & BIT(s));
+}
+
+// Remove s from sset; true iff s was in sset before.
+static inline bool testAndClear(state_set* sset, int s, bool atomic)
+{
+	word* w = WORD(sset, s);
+	if(!atomic)
+	{
+		if(!(*w & BIT(s)))
+			return false;
+		*w &= ~BIT(s);
+		return true;
+	}
+	return (__atomic_fetch_and(w, ~BIT(s), __ATOMIC_RELAXED) & BIT(s)) != 0;
+}
+
+// Decrement a counter; true iff it reached zero.
+static inline bool decrementToZero(int* c, bool atomic)
+{
+	return (atomic ? __atomic_sub_fetch(c, 1, __ATOMIC_RELAXED) : --*c) == 0;
+}
+
+// Queue of states of a fixpoint, in scratch memory with room for
+// every state once; the fixpoints never queue a state twice.
+struct worklist
+{
+	int* items;
+	int size;
+	bool shared; // pushed to by several threads at once
+
+	void push(int s)
+	{
+		items[shared ? __atomic_fetch_add(&size, 1, __ATOMIC_RELAXED) : size++] = s;
+	}
+};
 
 class model_derived : public model
 {
 	private:
-		std::set< pairs > state_src;
+		std::vector< pairs > arc_buf;   // arcs as added, sorted and consumed by finish()
+		std::vector<int> adj_buf;        // succ_off, succ, pred_off and pred, one after the other, when built by finish()
+		const int *succ_off, *succ;      // forward adjacency: successors of i are succ[succ_off[i] .. succ_off[i+1])
+		const int *pred_off, *pred;      // reverse adjacency: predecessors of i are pred[pred_off[i] .. pred_off[i+1])
 		int num_srcs;
-		
+		thread_pool* pool;               // null when single threaded
+		op_counters* counters;           // null unless the work is counted
+		std::vector<state_set*> free_sets; // deleted sets, recycled by makeEmptySet()
+		std::mutex free_lock;            // of free_sets, as operations may run concurrently
+		std::vector<scratch_arena*> arenas; // arrays of the operations, freed when they return; one per thread of the pool
+
+		// Count bytes of temporary storage, when counting.
+		void allocated(size_t bytes)
+		{
+			if(counters)
+				counters->bytes += bytes;
+		}
+
+		// Bytes of a state_set of this model.
+		size_t setBytes() const
+		{
+			return sizeof(word) * size_t((num_srcs + state_set::WORD_BITS - 1) / state_set::WORD_BITS);
+		}
+
+		// Scratch memory of the calling thread: operations running at the
+		// same time on different threads of the pool each have their own.
+		scratch_arena& scratch()
+		{
+			return *arenas[pool ? pool->threadIndex() : 0];
+		}
+
+		// Array of n T's in scratch memory, not initialized; an operation
+		// takes scratch().mark() first, and releases it before returning.
+		template <class T> T* scratchArray(size_t n)
+		{
+			allocated(n * sizeof(T));
+			return scratch().alloc<T>(n);
+		}
+
+		// A temporary dense set, from the recycled ones; deleteSet() it after use.
+		state_set* tempSet()
+		{
+			allocated(setBytes());
+			state_set* t = makeEmptySet();
+			t->makeDense();
+			return t;
+		}
+
+		// Make rset an empty dense set, unless it is dense already; its
+		// states are about to be overwritten.
+		void denseResult(state_set* rset)
+		{
+			if(!rset->isDense())
+			{
+				rset->resize(num_srcs);
+				rset->makeDense();
+			}
+		}
+
+		/*
+		  The temporal operators work on bitsets, a word and a bit per
+		  state. Declared first in such an operator, this expands each of
+		  its operands stored as chunks (labels, results of the boolean
+		  connectives) into a temporary set, redirects the operand to it,
+		  and makes the result dense; the temporaries are deleted when the
+		  operator returns. An operand that rset aliases is expanded
+		  before rset changes.
+		*/
+		class dense_args
+		{
+			model_derived* m;
+			state_set* temps[2];
+
+			void expand(const state_set*& sset, int i)
+			{
+				temps[i] = 0;
+				if(sset && !sset->isDense())
+				{
+					temps[i] = m->tempSet();
+					sset->toWords(temps[i]->data());
+					sset = temps[i];
+				}
+			}
+
+		  public:
+			dense_args(model_derived* md, const state_set*& sset, state_set* rset) : m(md)
+			{
+				expand(sset, 0);
+				temps[1] = 0;
+				m->denseResult(rset);
+			}
+
+			dense_args(model_derived* md, const state_set*& sset1, const state_set*& sset2, state_set* rset) : m(md)
+			{
+				expand(sset1, 0);
+				expand(sset2, 1);
+				m->denseResult(rset);
+			}
+
+			~dense_args()
+			{
+				for(int i = 0; i < 2; i++)
+					if(temps[i])
+						m->deleteSet(temps[i]);
+			}
+		};
+
+		// An empty worklist in scratch memory.
+		worklist newWorklist()
+		{
+			worklist q = { scratchArray<int>(num_srcs), 0, false };
+			return q;
+		}
+
+		// Count the states queue.items[lo..hi), and the arcs to their predecessors.
+		void countVisits(const worklist& queue, int lo, int hi)
+		{
+			counters->iterations += hi - lo;
+			for(int h = lo; h < hi; h++)
+				counters->arcs += pred_off[queue.items[h]+1] - pred_off[queue.items[h]];
+		}
+
+		// Run body(lo, hi) over [0, n), in chunks of grain when there is a pool.
+		template <class F> void forRange(int n, int grain, const F& body)
+		{
+			if(pool)
+				pool->parallel_for(0, n, grain, body);
+			else
+				body(0, n);
+		}
+
+		/*
+		  Backward worklist driver of the fixpoints. visit(s, queue) is
+		  called once for every state s of the queue and pushes the states
+		  it labels. Single threaded, the queue is simply run through. With
+		  a pool, it is expanded one frontier at a time, each frontier being
+		  split between the threads, which push to its end at once; visit
+		  must then label states with the atomic helpers above, so that
+		  each one is pushed only once.
+		*/
+		template <class F> void propagate(worklist& queue, const F& visit)
+		{
+			if(!pool)
+			{
+				for(int h = 0; h < queue.size; h++)
+					visit(queue.items[h], queue);
+				if(counters)
+					countVisits(queue, 0, queue.size);
+				return;
+			}
+
+			queue.shared = true;
+			for(int head = 0; head < queue.size; )
+			{
+				int tail = queue.size;
+				pool->parallel_for(head, tail, 256, [&](int lo, int hi) {
+					for(int h = lo; h < hi; h++)
+						visit(queue.items[h], queue);
+				});
+				if(counters)
+					countVisits(queue, head, tail);
+				head = tail;
+			}
+			queue.shared = false;
+		}
+
+		// Out-degree of every state, in scratch memory.
+		int* outDegrees()
+		{
+			int* count = scratchArray<int>(num_srcs);
+			forRange(num_srcs, 4096, [&](int lo, int hi) {
+				for(int i = lo; i < hi; i++)
+					count[i] = succ_off[i+1] - succ_off[i];
+			});
+			return count;
+		}
+
+		/*
+		  Label into rset every state of sset that lies on a cycle made of
+		  sset-states only, i.e. the members of the nontrivial strongly
+		  connected components of the graph restricted to sset.
+		  Iterative Tarjan: the DFS call stack is an explicit array, so
+		  long paths cannot overflow the machine stack. Every array holds
+		  each state at most once, and lives in scratch memory.
+		*/
+		void nontrivialSCCs(const state_set* sset, state_set* rset)
+		{
+			scratch_arena::mark_t mark = scratch().mark();
+			int* index = scratchArray<int>(num_srcs);
+			int* low = scratchArray<int>(num_srcs);
+			char* on_stack = scratchArray<char>(num_srcs);
+			int* scc_stack = scratchArray<int>(num_srcs);  // Tarjan's stack of open states
+			int* call_state = scratchArray<int>(num_srcs); // DFS frames: state,
+			int* call_arc = scratchArray<int>(num_srcs);   // and next arc to follow
+			int scc_top = 0, call_top = 0;
+			int counter = 0;
+
+			std::fill(index, index + num_srcs, -1);
+			std::fill(on_stack, on_stack + num_srcs, 0);
+			if(counters)
+			{
+				for(int s = sset->next(0); s >= 0; s = sset->next(s+1))
+					counters->arcs += succ_off[s+1] - succ_off[s];
+			}
+			rset->clear();
+			for(int root = sset->next(0); root >= 0; root = sset->next(root+1))
+			{
+				if(index[root] >= 0)
+					continue;
+				index[root] = low[root] = counter++;
+				scc_stack[scc_top++] = root; on_stack[root] = 1;
+				call_state[call_top] = root; call_arc[call_top++] = succ_off[root];
+
+				while(call_top > 0)
+				{
+					int v = call_state[call_top-1];
+					if(call_arc[call_top-1] < succ_off[v+1])
+					{
+						int w = succ[call_arc[call_top-1]++];
+						if(!sset->contains(w))
+							continue;
+						if(index[w] < 0) // tree arc: descend
+						{
+							index[w] = low[w] = counter++;
+							scc_stack[scc_top++] = w; on_stack[w] = 1;
+							call_state[call_top] = w; call_arc[call_top++] = succ_off[w];
+						}
+						else if(on_stack[w])
+							low[v] = std::min(low[v], index[w]);
+						continue;
+					}
+
+					// all arcs of v followed: return to the caller
+					call_top--;
+					if(call_top > 0)
+					{
+						int u = call_state[call_top-1];
+						low[u] = std::min(low[u], low[v]);
+					}
+					if(low[v] != index[v])
+						continue;
+
+					// v is the root of an SCC; it is nontrivial if it has more
+					// than one state, or a single state with a self loop
+					bool nontrivial = scc_stack[scc_top-1] != v
+						|| std::binary_search(succ+succ_off[v], succ+succ_off[v+1], v);
+					int t;
+					do
+					{
+						t = scc_stack[--scc_top];
+						on_stack[t] = 0;
+						if(nontrivial)
+							rset->insert(t);
+					} while(t != v);
+				}
+			}
+			scratch().release(mark);
+		}
+
+		// Give rset the states of temp, a set from tempSet(), by swapping
+		// their words; temp is then deleted.
+		void swapIn(state_set* temp, state_set* rset)
+		{
+			rset->swap(*temp);
+			deleteSet(temp);
+		}
+
+		/*
+		  E p U q, and EF q when sset1 is 0. Computed in rset, seeded with
+		  q, unless rset is also p, which is read until the end.
+		*/
+		void until(const state_set* sset1, const state_set* sset2, state_set* rset)
+		{
+		    scratch_arena::mark_t mark = scratch().mark();
+		    state_set* temp= (rset == sset1) ? tempSet() : rset;
+		    worklist queue = newWorklist(); // states labelled E p U q whose predecessors are not yet checked
+
+		    copy(sset2,temp);  // Any state labelled with q is also E p U q
+		    for(int s = temp->next(0); s >= 0; s = temp->next(s+1))
+		    	queue.push(s);
+
+		    extendUntil(sset1,temp,queue);
+
+		    if(temp != rset)
+		    	swapIn(temp,rset);
+		    scratch().release(mark);
+		}
+
+		/*
+		  Any state in p with some successor in E p U q is also in E p U q:
+		  label into rset the p-predecessors of the queued states, and
+		  theirs in turn. Each state enters the queue at most once, so
+		  every arc is looked at once, from its destination.
+		*/
+		void extendUntil(const state_set* sset1, state_set* rset, worklist& queue)
+		{
+		    bool par = pool != 0;
+		    propagate(queue, [&](int s, worklist& out) {
+		    	for(int k = pred_off[s]; k < pred_off[s+1]; k++)
+		    	{
+		    		int t = pred[k];
+		    		if((!sset1 || sset1->contains(t)) && testAndSet(rset, t, par))
+		    			out.push(t);
+		    	}
+		    });
+		}
+
+		// Any state with a successor outside AG p is not in AG p: remove
+		// from rset the predecessors of the queued states, and theirs in turn.
+		void shrinkGlobally(state_set* rset, worklist& queue)
+		{
+			bool par = pool != 0;
+			propagate(queue, [&](int s, worklist& out) {
+				for(int k = pred_off[s]; k < pred_off[s+1]; k++)
+				{
+					int t = pred[k];
+					if(testAndClear(rset, t, par))
+						out.push(t);
+				}
+			});
+		}
+
+		// Does s have a successor in sset (or, if in is false, outside it)?
+		bool hasSuccessor(int s, const state_set* sset, bool in)
+		{
+			for(int k = succ_off[s]; k < succ_off[s+1]; k++)
+				if(sset->contains(succ[k]) == in)
+					return true;
+			return false;
+		}
+
 	public:
 	model_derived() : model()
 	{
 		num_srcs=0;	
-			
+		pool=0;
+		counters=0;
+		succ_off=succ=pred_off=pred=0;
+		arenas.push_back(new scratch_arena);
+	}
+
+	~model_derived()
+	{
+		delete pool;
+		for(size_t i = 0; i < free_sets.size(); i++)
+			delete free_sets[i];
+		for(size_t i = 0; i < arenas.size(); i++)
+			delete arenas[i];
+	}
+
+	void setNumThreads(int n)
+	{
+		delete pool;
+		pool = (n > 1) ? new thread_pool(n) : 0;
+		while(int(arenas.size()) < n)
+			arenas.push_back(new scratch_arena);
+	}
+
+	thread_pool* concurrentPool()
+	{
+		return pool;
+	}
+
+	void setCounters(op_counters* c)
+	{
+		counters = c;
 	}
 
 	void setNumStates(int n)
@@ -42,391 +465,565 @@ class model_derived : public model
 	{
 		return (s>=0 && s<=num_srcs-1);
 	}
+
+	int getNumStates()
+	{
+		return num_srcs;
+	}
 	
 	void addArc(state_id s1, state_id s2)
 	{
-	    state_src.insert(std::make_pair (s1,s2));
+	    arc_buf.push_back(std::make_pair (s1,s2));
 	}
 	
-	state_set* makeEmptySet()
+	state_set* makeEmptySet() // a deleted set if there is one: its words are already allocated
 	{
-		state_set* t = new state_set();
+		state_set* t = 0;
+		{
+			std::lock_guard<std::mutex> lk(free_lock);
+			if(!free_sets.empty())
+			{
+				t = free_sets.back();
+				free_sets.pop_back();
+			}
+		}
+		if(!t)
+			return new state_set(num_srcs);
+		if(t->size() == num_srcs)
+			t->clear();
+		else
+			t->resize(num_srcs);
 		return t;
 	}
 	
 	
 	void deleteSet(state_set* sset)
 	{
- 		delete sset;	
+		std::lock_guard<std::mutex> lk(free_lock);
+ 		free_sets.push_back(sset);
 	}
 	
 	void addState(state_id s, state_set* sset)
 	{
-		sset->insert(s);
+		if(isValidState(s))
+			sset->insert(s);
 	}
 	
 	void copy(const state_set* sset, state_set* rset) // Clears out rset and copies sset into rset
 	{
-	    state_set* temp= new state_set();
-		temp->insert(sset->begin(),sset->end());
-		rset->clear();
-		rset->insert(temp->begin(),temp->end());
-		
-		delete temp;
+		if(rset == sset)
+			return;
+		if(!sset->isDense())
+		{
+			*rset = *sset;
+			return;
+		}
+		if(rset->size() != sset->size())
+			rset->resize(sset->size());
+		rset->makeDense();
+		std::copy(sset->data(), sset->data() + sset->numWords(), rset->data());
+	}
+
+	void compact(state_set* sset)
+	{
+		sset->optimize();
 	}
 	
 	void NOT(const state_set* sset, state_set* rset)
 	{
-		state_set* temp= new state_set();
-	    
-	    std::set<pairs> :: iterator it_model ;
-		int tag=-1;
-	    for(it_model=state_src.begin();it_model!=state_src.end();it_model++) // Insert those states from the KS into temp set which are not found in sset 
-	    	{
-	    		int f_item = (*it_model).first;
-	    		if(f_item > tag)
-	    		{	tag=f_item;
-	    		     state_set:: iterator it = (*sset).find(tag);
-	    		    if(it == sset->end())
-	    			{
-	    			  	(temp)->insert(tag);
-	    			}
-	    		}
-	    	}
-	    rset->clear();	
-	    copy(temp,rset);
-	    
-	    delete temp;	
-	   }
-	
+		if(!sset->isDense()) // chunk by chunk, into a chunked result
+		{
+			rset->assignNot(*sset);
+			return;
+		}
+		denseResult(rset);
+		const word* a = sset->data();
+		word* r = rset->data();
+		int nw = rset->numWords();
+
+		forRange(nw, 4096, [&](int lo, int hi) { // flip every state of the KS, then drop the bits past the last state
+			for(int w = lo; w < hi; w++)
+				r[w] = ~a[w];
+		});
+		if(nw)
+			r[nw-1] &= rset->tailMask();
+	}
+
 	bool elementOf(state_id s, const state_set* sset)
 	{
-		
-		state_set :: iterator it_state  = sset->find(s);
-		if(it_state != sset->end())
-			return true;
-		else
-			return false;
-		
+		return isValidState(s) && sset->contains(s);
 	}
-	
+
 	bool finish() 
 	{
-		 std::set<pairs> :: iterator it_model ;
+		 if(!std::is_sorted(arc_buf.begin(), arc_buf.end()))
+		 	std::sort(arc_buf.begin(), arc_buf.end()); // by source, then by destination
+		 arc_buf.erase(std::unique(arc_buf.begin(), arc_buf.end()), arc_buf.end());
+
+		 std::vector<pairs> :: iterator it_model ;
 		 int tag=-1;
-	 	 for (it_model=state_src.begin(); it_model!=state_src.end(); ++it_model) // Check if all the states have atleast one outgoing edge
+	 	 for (it_model=arc_buf.begin(); it_model!=arc_buf.end(); ++it_model) // Check if all the states have atleast one outgoing edge
 	 	 {
 	 		int frt = (*it_model).first;
-	 		
-	 		if(!isValidState(frt)) // Invalid state
+	 		int snd = (*it_model).second;
+
+	 		if(!isValidState(frt) || !isValidState(snd)) // Invalid state
 	 		{
-	 			std::cout<<"\nState "<< frt <<" does not lie between ["<< 0 <<","<<num_srcs-1<<"] \n";
+	 			*messages<<"\nState "<< (isValidState(frt) ? snd : frt) <<" does not lie between ["<< 0 <<","<<num_srcs-1<<"] \n";
 				return false;
-	 		
+
 	 		}
-	 		
+
 	 		if(frt==tag+1) // At least one outgoing edge on each.
 	 				tag = frt;
 	 		else if(frt>tag+1)
 	 		{
-	 			std::cout<<"\nState "<< tag+1 <<" does not have any outgoing edge \n";
+	 			*messages<<"\nState "<< tag+1 <<" does not have any outgoing edge \n";
 				return false;
 		 	}
-	 				
+
+	 	}
+	 	if(tag+1 < num_srcs) // trailing states without any arc
+	 	{
+	 		*messages<<"\nState "<< tag+1 <<" does not have any outgoing edge \n";
+			return false;
+	 	}
+
+	 	// Build both adjacency arrays. arc_buf is sorted by source, so the
+	 	// forward one is a single pass; the reverse one is a counting sort
+	 	// on the destination.
+	 	int num_arcs = arc_buf.size();
+	 	adj_buf.assign(2*(num_srcs+1) + 2*num_arcs, 0);
+	 	int* s_off = &adj_buf[0];
+	 	int* s = s_off + num_srcs+1;
+	 	int* p_off = s + num_arcs;
+	 	int* p = p_off + num_srcs+1;
+	 	for(int k = 0; k < num_arcs; k++)
+	 	{
+	 		s_off[arc_buf[k].first+1]++;
+	 		p_off[arc_buf[k].second+1]++;
+	 		s[k] = arc_buf[k].second;
 	 	}
- 		
+	 	for(int i = 0; i < num_srcs; i++)
+	 	{
+	 		s_off[i+1] += s_off[i];
+	 		p_off[i+1] += p_off[i];
+	 	}
+	 	std::vector<int> fill(p_off, p_off+num_srcs);
+	 	for(int k = 0; k < num_arcs; k++)
+	 		p[fill[arc_buf[k].second]++] = arc_buf[k].first;
+
+	 	std::vector<pairs>().swap(arc_buf); // staging buffer no longer needed
+	 	succ_off = s_off; succ = s;
+	 	pred_off = p_off; pred = p;
+
 		return true;
 			
+	}
+
+	bool changeArcs(const std::vector<pairs>& added, const std::vector<pairs>& removed)
+	{
+		if(!succ_off)
+			return false;
+		std::vector<pairs> add(added), del(removed);
+		std::sort(add.begin(), add.end());
+		std::sort(del.begin(), del.end());
+		for(size_t k = 0; k < del.size(); k++) // only arcs of the model, or added with them, can be removed
+		{
+			int frt = del[k].first, snd = del[k].second;
+			if(!isValidState(frt) || !isValidState(snd))
+			{
+				*messages<<"\nState "<< (isValidState(frt) ? snd : frt) <<" does not lie between ["<< 0 <<","<<num_srcs-1<<"] \n";
+				return false;
+			}
+			if(!std::binary_search(succ + succ_off[frt], succ + succ_off[frt+1], snd)
+				&& !std::binary_search(add.begin(), add.end(), del[k]))
+			{
+				*messages<<"\nArc S"<< frt <<" -> S"<< snd <<" is not in the model \n";
+				return false;
+			}
+		}
+		// an arc both added and removed is removed
+		add.erase(std::remove_if(add.begin(), add.end(), [&](const pairs& arc) {
+			return std::binary_search(del.begin(), del.end(), arc);
+		}), add.end());
+
+		// the arcs are already in order: merge the added ones in, and
+		// leave the removed ones out
+		arc_buf.reserve(succ_off[num_srcs] + add.size());
+		size_t a = 0, d = 0;
+		for(int i = 0; i < num_srcs; i++)
+			for(int k = succ_off[i]; k < succ_off[i+1]; k++)
+			{
+				pairs arc(i, succ[k]);
+				while(a < add.size() && add[a] < arc)
+					arc_buf.push_back(add[a++]);
+				while(d < del.size() && del[d] < arc)
+					d++;
+				if(d == del.size() || del[d] != arc)
+					arc_buf.push_back(arc);
+			}
+		arc_buf.insert(arc_buf.end(), add.begin() + a, add.end());
+		arc_buf.erase(std::unique(arc_buf.begin(), arc_buf.end()), arc_buf.end());
+
+		if(!finish()) // the arrays are only replaced once the arcs are checked
+		{
+			std::vector<pairs>().swap(arc_buf);
+			return false;
+		}
+		return true;
+	}
+
+	bool getGraph(kripke_graph& g)
+	{
+		if(!succ_off)
+			return false;
+		g.num_states = num_srcs;
+		g.num_arcs = succ_off[num_srcs];
+		g.succ_off = succ_off; g.succ = succ;
+		g.pred_off = pred_off; g.pred = pred;
+		return true;
+	}
+
+	bool setGraph(const kripke_graph& g) // uses the arrays in place, e.g. from a mapped .ksb file
+	{
+		for(int i = 0; i < g.num_states; i++) // as finish(): at least one outgoing edge on each
+			if(g.succ_off[i] == g.succ_off[i+1])
+			{
+				*messages<<"\nState "<< i <<" does not have any outgoing edge \n";
+				return false;
+			}
+		std::vector<pairs>().swap(arc_buf);
+		std::vector<int>().swap(adj_buf);
+		num_srcs = g.num_states;
+		succ_off = g.succ_off; succ = g.succ;
+		pred_off = g.pred_off; pred = g.pred;
+		return true;
 	}
 	 
 	 void  OR(const state_set* sset1, const state_set* sset2, state_set* rset)
 	{
-		rset->insert(sset1->begin(),sset1->end());
-		rset->insert(sset2->begin(),sset2->end());
-				
+		if(!sset1->isDense() || !sset2->isDense())
+		{
+			rset->assignOr(*sset1, *sset2);
+			return;
+		}
+		denseResult(rset);
+		const word* a = sset1->data();
+		const word* b = sset2->data();
+		word* r = rset->data();
+		int nw = rset->numWords();
+
+		forRange(nw, 4096, [&](int lo, int hi) {
+			for(int w = lo; w < hi; w++)
+				r[w] = a[w] | b[w];
+		});
 	}
-	 
+
 	void AND(const state_set* sset1, const state_set* sset2, state_set* rset)
 	{
-	 	state_set* temp= new state_set();
-	    state_set* rset_not_sset1 = new state_set() ;
-	    state_set* rset_not_sset2 = new state_set() ;
-	    state_set* rset_or = new state_set() ;
-	    
-	    NOT(sset1,rset_not_sset1); // !p
-	    NOT(sset2,rset_not_sset2); // !q
-		
-		OR(rset_not_sset1,rset_not_sset2,rset_or); // !p || !q == !(p && q)
-		NOT(rset_or,temp); // p && q
-		
-		rset->clear();
-		copy(temp,rset);
-		
-		delete rset_not_sset1;
-		delete rset_not_sset2;
-		delete rset_or;
-		delete temp;
+		if(!sset1->isDense() || !sset2->isDense())
+		{
+			rset->assignAnd(*sset1, *sset2);
+			return;
+		}
+		denseResult(rset);
+		const word* a = sset1->data();
+		const word* b = sset2->data();
+		word* r = rset->data();
+		int nw = rset->numWords();
+
+		forRange(nw, 4096, [&](int lo, int hi) {
+			for(int w = lo; w < hi; w++)
+				r[w] = a[w] & b[w];
+		});
 	}
-	 
+
 	void IMPLIES(const state_set* sset1, const state_set* sset2, state_set* rset)
 	{
-	 	state_set* temp= new state_set();
-	    state_set* rset_not_sset1 = new state_set();
-	    
-	    NOT(sset1,rset_not_sset1); // !p
-		
-		OR(rset_not_sset1,sset2,temp); // !p || q == p -> q
-
-		rset->clear();
-		copy(temp,rset);
-		
-		delete temp;
-		delete rset_not_sset1;
+		if(!sset1->isDense() || !sset2->isDense())
+		{
+			rset->assignImplies(*sset1, *sset2);
+			return;
+		}
+		denseResult(rset);
+		const word* a = sset1->data();
+		const word* b = sset2->data();
+		word* r = rset->data();
+		int nw = rset->numWords();
+
+		forRange(nw, 4096, [&](int lo, int hi) { // !p || q == p -> q
+			for(int w = lo; w < hi; w++)
+				r[w] = ~a[w] | b[w];
+		});
+		if(nw)
+			r[nw-1] &= rset->tailMask();
 	 }
-	 
+
 	void EX(const state_set* sset, state_set* rset) 
 	{
-		
-		state_set* temp= new state_set();
-	    state_set :: iterator it_state;
-	   
-	    for(int i = 0; i<num_srcs;i++)
-	    {
-	    	for(it_state=sset->begin();it_state!=sset->end();it_state++)
+		dense_args dense(this, sset, rset);
+		// rset is written while sset is still being read, so an aliased
+		// rset is computed into a second set, swapped in at the end
+		state_set* temp= (rset == sset) ? tempSet() : rset;
+		word* t = temp->data();
+		if(counters) // at most; a state's scan stops at its first successor in p
+			counters->arcs += succ_off[num_srcs];
+
+		// one word of temp per step, so that threads never share a word
+	    forRange(temp->numWords(), 64, [&](int lo, int hi) {
+	    	for(int w = lo; w < hi; w++)
 	    	{
-	    		std::set<pairs> :: iterator it=state_src.find(std::make_pair (i,(*it_state)));
-	    		if(it != state_src.end()) // if i is reachable to a state in sset in 1 step
+	    		word bits = 0;
+	    		int end = std::min(num_srcs, (w+1) * state_set::WORD_BITS);
+	    		for(int i = w * state_set::WORD_BITS; i < end; i++)
+	    			for(int k = succ_off[i]; k < succ_off[i+1]; k++)
 	    			{
-	    				temp->insert(i);
-	    				break;
+	    				if(sset->contains(succ[k])) // if i is reachable to a state in sset in 1 step
+	    				{
+	    					bits |= BIT(i);
+	    					break;
+	    				}
 	    			}
+	    		t[w] = bits;
 	    	}
-	    }
-	    rset->clear();
-	    copy(temp,rset);
-	    
-	    delete temp;
+	    });
+
+	    if(temp != rset)
+	    	swapIn(temp,rset);
 	}
 	 
 	void AX(const state_set* sset, state_set* rset) 
 	{
-		state_set* temp= new state_set();
-	    state_set* rset_not_sset = new state_set();
-	    state_set* rset_ex_not = new state_set();
-	    
-	    
-	    NOT(sset,rset_not_sset); // !p
-	    
-	    EX(rset_not_sset,rset_ex_not); // EX !p
-	    delete rset_not_sset;
-	    
-	    NOT(rset_ex_not,temp); // !EX !p = AX p	  
-	    
-	    rset->clear();
-	    copy(temp,rset);
-	    
-	    delete rset_ex_not;
-	    delete temp;  
+		dense_args dense(this, sset, rset);
+		// as EX
+		state_set* temp= (rset == sset) ? tempSet() : rset;
+		word* t = temp->data();
+		if(counters) // at most; a state's scan stops at its first successor outside p
+			counters->arcs += succ_off[num_srcs];
+
+	    forRange(temp->numWords(), 64, [&](int lo, int hi) {
+	    	for(int w = lo; w < hi; w++)
+	    	{
+	    		word bits = 0;
+	    		int end = std::min(num_srcs, (w+1) * state_set::WORD_BITS);
+	    		for(int i = w * state_set::WORD_BITS; i < end; i++)
+	    		{
+	    			bool all_succ = true;
+	    			for(int k = succ_off[i]; k < succ_off[i+1]; k++)
+	    			{
+	    				if(!sset->contains(succ[k])) // i has a successor outside p
+	    				{
+	    					all_succ = false;
+	    					break;
+	    				}
+	    			}
+	    			if(all_succ)
+	    				bits |= BIT(i);
+	    		}
+	    		t[w] = bits;
+	    	}
+	    });
+
+	    if(temp != rset)
+	    	swapIn(temp,rset);
 	}
 	 
 	void EF(const state_set* sset, state_set* rset) 
 	{
-		state_set* temp= new state_set();
-	    state_set* rset_true = new state_set();
-	    
-	    for(int i=0;i < num_srcs; i++) // true
-	    	rset_true->insert(i);
-	    	
-	    EU(rset_true,sset,temp); // E tt U p
-	    
-	    rset->clear();
-	    copy(temp,rset); 
-	    
-	    delete temp;
-	    delete rset_true;
+	    dense_args dense(this, sset, rset);
+	    until(0,sset,rset); // E tt U p
 	}
 	 
 	void AF(const state_set* sset, state_set* rset) 
 	{
-    
-	    state_set* temp= new state_set();
-	    state_set temp1,temp2;
-	    
-	    copy(sset,temp);
-	    temp2=*temp;
-	   
-	    state_set :: iterator it_state;
-	    std::set<pairs> :: iterator it;
-	    int i_new,flag;
-	    
-	    do // does until no further states can be marked
-	    {
-		 i_new = -1; // holds the state_id for which AF p is true
-		 flag = -1; 
-		 temp1 = temp2;
-     	 for(it = state_src.begin(); it != state_src.end();it++) // Any state whose all successors are in AF p , is also in AF p
-	     {
-	        
-	    	int s = (*it).first;
-	    	int d = (*it).second;
-	    	
-			if((i_new != flag)&&(s>i_new))
-				temp->insert(i_new);
-		
-			if(s == flag)
-				continue;
-			
-			if(s>i_new)
-				i_new=s;
-			
-			if((*temp).find(d) == (*temp).end())
-					flag = i_new;
-			 
-	      }
-	    
-	      temp2=*temp; 
-	     
-	      }while(temp1 != temp2);	
-			
-	     rset->clear();
-	      copy(temp,rset);
-	      delete temp;
+	    dense_args dense(this, sset, rset);
+	    scratch_arena::mark_t mark = scratch().mark();
+	    int* count = outDegrees();        // successors of each state not yet labelled AF p
+	    worklist queue = newWorklist();   // labelled states whose predecessors are not yet told
+	    bool par = pool != 0;
+
+	    // p is only read here, so AF p is computed in rset itself
+	    copy(sset,rset); // Any state labelled with p is also AF p
+	    for(int s = rset->next(0); s >= 0; s = rset->next(s+1))
+	    	queue.push(s);
+
+	    // Any state whose all successors are in AF p, is also in AF p:
+	    // when the counter of a state drops to zero, it is labelled.
+	    propagate(queue, [&](int s, worklist& out) {
+	    	for(int k = pred_off[s]; k < pred_off[s+1]; k++)
+	    	{
+	    		int t = pred[k];
+	    		if(!isLabelled(rset, t, par) && decrementToZero(&count[t], par))
+	    		{
+	    			testAndSet(rset, t, par);
+	    			out.push(t);
+	    		}
+	    	}
+	    });
+	    scratch().release(mark);
 	  }
-	
+
 	void AG(const state_set* sset, state_set* rset) 
 	{
-		state_set* temp= new state_set();
-	    state_set* rset_not_sset = new state_set();
-	    
-	    
-	    NOT(sset,rset_not_sset); // !p
-	    
-	    state_set* rset_ef_not = new state_set();
-	    EF(rset_not_sset,rset_ef_not); // EF !p
-	    delete rset_not_sset;
-	    
-	    NOT(rset_ef_not,temp); // !EF !p = AG p
-	    
-	    std::cout<<"CHeck AG::";
-	    display(temp);
-	    rset->clear();
-	    copy(temp,rset);
-	    
-	    delete temp;
-	    delete rset_ef_not;
+		dense_args dense(this, sset, rset);
+		scratch_arena::mark_t mark = scratch().mark();
+		worklist queue = newWorklist(); // states removed from AG p whose predecessors are not yet removed
+
+		copy(sset,rset); // start from p, and remove states until none can be removed
+		for(int i = 0; i < num_srcs; i++)
+			if(!rset->contains(i))
+				queue.push(i);
+
+		shrinkGlobally(rset,queue);
+		scratch().release(mark);
 	}
-	 
+
+	void EUgrow(const state_set* sset1, const state_set* sset2, const state_set* check, state_set* rset)
+	{
+	    rset->makeDense(); // the earlier result, kept
+	    dense_args dense(this, sset1, sset2, rset);
+	    scratch_arena::mark_t mark = scratch().mark();
+	    worklist queue = newWorklist();
+
+	    // Only the new q-states, and the states of check with a successor
+	    // in E p U q, can start a path the earlier result lacks; every
+	    // other state of it already had its predecessors checked.
+	    for(int s = sset2->next(0); s >= 0; s = sset2->next(s+1))
+	    	if(testAndSet(rset, s, false))
+	    		queue.push(s);
+	    for(int t = check->next(0); t >= 0; t = check->next(t+1))
+	    	if(!rset->contains(t) && (!sset1 || sset1->contains(t)) && hasSuccessor(t, rset, true))
+	    	{
+	    		rset->insert(t);
+	    		queue.push(t);
+	    	}
+
+	    extendUntil(sset1,rset,queue);
+	    scratch().release(mark);
+	}
+
+	void AGshrink(const state_set* sset, const state_set* check, state_set* rset)
+	{
+		rset->makeDense(); // the earlier result, kept
+		dense_args dense(this, sset, rset);
+		scratch_arena::mark_t mark = scratch().mark();
+		worklist queue = newWorklist();
+
+		// as EUgrow: the states no longer in p, and the states of check
+		// with a new successor outside AG p
+		for(int s = rset->next(0); s >= 0; s = rset->next(s+1))
+			if(!sset->contains(s))
+			{
+				rset->erase(s);
+				queue.push(s);
+			}
+		for(int t = check->next(0); t >= 0; t = check->next(t+1))
+			if(rset->contains(t) && hasSuccessor(t, rset, false))
+			{
+				rset->erase(t);
+				queue.push(t);
+			}
+
+		shrinkGlobally(rset,queue);
+		scratch().release(mark);
+	}
+
 	void EG(const state_set* sset, state_set* rset)
 	{
-		state_set* temp= new state_set();
-	    state_set* rset_not_sset = new state_set();
-	    
-	    
-	    NOT(sset,rset_not_sset); // !p
-	    
-	    
-	    state_set* rset_af_not = new state_set();
-	    AF(rset_not_sset,rset_af_not); // AF !p
-	    delete rset_not_sset;
-	    
-	    NOT(rset_af_not,temp); // !AF !p = EG p
-	    rset->clear();
-	    copy(temp,rset);
-	    
-	    delete temp;
-	    delete rset_af_not;
-	    
+		dense_args dense(this, sset, rset);
+		if(!pool)
+		{
+			state_set* temp= tempSet();
+
+			nontrivialSCCs(sset,temp); // p-states on a p-cycle satisfy EG p
+			until(sset,temp,temp);     // and so does any p-path leading to one
+			swapIn(temp,rset);
+			return;
+		}
+
+		// Tarjan's search is inherently sequential, so with several threads
+		// EG is computed as the greatest fixpoint of p & EX Z instead: a
+		// p-state is removed once none of its successors is left.
+		scratch_arena::mark_t mark = scratch().mark();
+		int* count = scratchArray<int>(num_srcs); // successors of each state still in EG p
+		worklist queue = newWorklist();           // removed states whose predecessors are not yet told
+		if(counters)
+			counters->arcs += succ_off[num_srcs];
+
+		copy(sset,rset);
+		forRange(num_srcs, 4096, [&](int lo, int hi) {
+			for(int i = lo; i < hi; i++)
+			{
+				count[i] = 0;
+				for(int k = succ_off[i]; k < succ_off[i+1]; k++)
+					count[i] += rset->contains(succ[k]);
+			}
+		});
+		for(int s = rset->next(0); s >= 0; s = rset->next(s+1))
+			if(count[s] == 0)
+				queue.push(s);
+		for(int h = 0; h < queue.size; h++)
+			rset->erase(queue.items[h]);
+
+		propagate(queue, [&](int s, worklist& out) {
+			for(int k = pred_off[s]; k < pred_off[s+1]; k++)
+			{
+				int t = pred[k];
+				if(isLabelled(rset, t, true) && decrementToZero(&count[t], true)
+					&& testAndClear(rset, t, true))
+					out.push(t);
+			}
+		});
+		scratch().release(mark);
 	}
 	 
 	void EU(const state_set* sset1, const state_set* sset2, state_set* rset) 
 	{
-	    state_set* temp= new state_set();
-	    state_set temp1,temp2;
-	    
-	    copy(sset2,temp);  // Any state labelled with q is also E p U q
-	    temp2=*temp;
-	    
-
-	  
-	    state_set :: iterator it_state;
-	    std::set<pairs> :: iterator it;
-	    do // does until no further states can be marked
-	    {
-	     temp1 = temp2;
-	     for(it_state = (*sset1).begin();it_state!=(*sset1).end();it_state++) // Any state in p whose some successor is in E p U q , is also in E p U q
-	     {
-	    	for(int j = 0;j < num_srcs;j++)
-	    	{
-	    		
-	    		it=state_src.find(std::make_pair ((*it_state),j));
-					if((*temp).find((*it).second) != (*temp).end())
-	    			{
-	    				temp->insert(*it_state);
-	    				break;
-	    			}
-	    	}
-	    	
-	      }
-	      temp2 = *temp;
-	     }while(temp1!=temp2);
-	     
-	     rset->clear();   
-	     display(temp);
-	     copy(temp,rset);
-	     display(rset);
-	     delete temp;
+	    dense_args dense(this, sset1, sset2, rset);
+	    until(sset1,sset2,rset);
 	}
-	 
+
 	void AU(const state_set* sset1, const state_set* sset2, state_set* rset) 
 	{
-	 	state_set* temp= new state_set();
-	    state_set* rset_not_sset1 = new state_set(); ; // !p
-	    state_set* rset_not_sset2 = new state_set(); ; //!q
-	    
-	    
-	    NOT(sset1,rset_not_sset1); // !p
-	    NOT(sset2,rset_not_sset2); // !q
-	    
-	    state_set* rset_and_pnq = new state_set();; // p && !q
-	    state_set* rset_and_npnq = new state_set(); ; // !p && !q
-	   
-	    AND(sset1,rset_not_sset2,rset_and_pnq); // p && !q
-	    AND(rset_not_sset1,rset_not_sset2,rset_and_npnq); // !p && !q
-	    
-	    state_set* rset_eu = new state_set();
-	    EU(rset_and_pnq,rset_and_npnq,rset_eu);
-	    
-	    delete rset_not_sset1;
-	    delete rset_and_npnq;
-	    delete rset_and_pnq;
-	    
-	    state_set* rset_eg_not = new state_set();
-	    EG(rset_not_sset2,rset_eg_not); // EG !q
-	    delete rset_not_sset2;
-	    
-	    state_set* rset_union = new state_set();
-	    OR(rset_eu,rset_eg_not,rset_union); // rset_eg_not || rset_eu
-	    NOT(rset_union,temp);
-	    
-	    rset->clear();
-	    copy(temp,rset);
-	    
-	    delete rset_union;
-	    delete rset_eg_not;
-	    delete rset_eu;
-	    delete temp;
-	    
-	    
+		dense_args dense(this, sset1, sset2, rset);
+		// p is read until the end, so a result aliasing it is computed
+		// into a second set, swapped in at the end
+		scratch_arena::mark_t mark = scratch().mark();
+		state_set* temp= (rset == sset1) ? tempSet() : rset;
+	    int* count = outDegrees();        // successors of each state not yet labelled A p U q
+	    worklist queue = newWorklist();   // labelled states whose predecessors are not yet told
+	    bool par = pool != 0;
+
+	    copy(sset2,temp); // Any state labelled with q is also A p U q
+	    for(int s = temp->next(0); s >= 0; s = temp->next(s+1))
+	    	queue.push(s);
+
+	    // Any state in p whose all successors are in A p U q, is also in A p U q
+	    propagate(queue, [&](int s, worklist& out) {
+	    	for(int k = pred_off[s]; k < pred_off[s+1]; k++)
+	    	{
+	    		int t = pred[k];
+	    		if(!isLabelled(temp, t, par) && decrementToZero(&count[t], par) && sset1->contains(t))
+	    		{
+	    			testAndSet(temp, t, par);
+	    			out.push(t);
+	    		}
+	    	}
+	    });
+
+	    if(temp != rset)
+	    	swapIn(temp,rset);
+	    scratch().release(mark);
 	}
-	
+
 	 
-	void display(const state_set* sset)
+	void display(const state_set* sset, std::ostream& out)
 	{
-	 	printf(":");
-	 	state_set :: iterator it_state;
-	 	for (it_state=(*sset).begin(); it_state!=(*sset).end(); ++it_state)
- 			std::cout << (*it_state)<<"  ";
- 		std::cout << "\n";
+	 	out << ":";
+	 	for (int s = sset->next(0); s >= 0; s = sset->next(s+1))
+ 			out << s <<"  ";
+ 		out << "\n";
 	}
 };
 
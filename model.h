@@ -1,20 +1,184 @@
 #ifndef __MODEL_H__
 #define __MODEL_H__
 
-#include <set>
+#include <iostream>
+#include <utility>
+#include <vector>
+#include <stdint.h>
 #include <stdlib.h>
 
 typedef int state_id;
 
+class thread_pool;    // see thread_pool.h
+
 /**
   Class used to store subsets of states of a Kripke structure.
-  
-  Students must define this as they see fit, to support the required
-  model checking operations.
+
+  Sets are created by model::makeEmptySet() with room for exactly
+  the number of states of the model, and have one of two forms:
+
+  - dense: a bitset, where state s is bit (s % 64) of word (s / 64).
+    Bits past the last state are always kept zero, so that whole
+    words can be compared and counted. The labeling operations work
+    on this form, through data().
+
+  - chunked: the states are split in chunks of CHUNK_STATES, and only
+    the chunks holding some state are stored, each one as a sorted
+    array of offsets, a bitmap, or a list of runs, whichever is the
+    smallest (as in roaring bitmaps). An empty set takes no memory
+    beyond the object, a label of a few states a few bytes each, and
+    a label of nearly all states a few bytes per run.
+
+  Sets start empty and chunked; makeDense() and optimize() switch
+  forms. Membership, insertion, iteration, counting and the boolean
+  operations assignAnd() etc. work on either form.
+
+  Models with another representation derive their sets from this
+  class and leave it empty (see symbolic_model.cpp).
+*/
+class state_set {
+  public:
+    typedef uint64_t word;
+    static const int WORD_BITS = 64;
+    static const int CHUNK_STATES = 1 << 16;
+    static const int CHUNK_WORDS = CHUNK_STATES / WORD_BITS;
+
+    state_set() : num_states(0), dense(false) { }
+    explicit state_set(int n) { resize(n); }
+
+    /// Make room for states 0..n-1, and empty the set (chunked).
+    void resize(int n);
+
+    /// Number of states this set has room for (not its cardinality).
+    int size() const { return num_states; }
+
+    /// Words of the dense form.
+    int numWords() const { return (num_states + WORD_BITS - 1) / WORD_BITS; }
+
+    bool isDense() const { return dense; }
+
+    /// Switch to the dense form, keeping the states.
+    void makeDense();
+
+    /// Switch to the chunked form, each chunk in its smallest container.
+    void optimize();
+
+    /// The bitset of a dense set; 0 for a chunked one.
+    word* data() { return words.empty() ? 0 : &words[0]; }
+    const word* data() const { return words.empty() ? 0 : &words[0]; }
+
+    /// Write the states as a bitset of numWords() words, whatever the form.
+    void toWords(word* out) const;
+
+    /// Mask of the valid bits of the last word.
+    word tailMask() const {
+      int r = num_states % WORD_BITS;
+      return r ? (word(1) << r) - 1 : ~word(0);
+    }
+
+    bool contains(state_id s) const {
+      if (dense) return (words[s / WORD_BITS] >> (s % WORD_BITS)) & 1;
+      return chunkContains(s);
+    }
+    void insert(state_id s) {
+      if (dense) words[s / WORD_BITS] |= word(1) << (s % WORD_BITS);
+      else chunkInsert(s);
+    }
+    void erase(state_id s) {
+      if (dense) words[s / WORD_BITS] &= ~(word(1) << (s % WORD_BITS));
+      else chunkErase(s);
+    }
+
+    /// Exchange the states (and sizes and forms) of two sets, without copying.
+    void swap(state_set& other) {
+      std::swap(num_states, other.num_states);
+      std::swap(dense, other.dense);
+      words.swap(other.words);
+      chunks.swap(other.chunks);
+    }
+
+    void clear();
+    void fill();
+
+    /// Number of states in the set.
+    int count() const;
+
+    /// Smallest state >= s in the set, or -1 if there is none.
+    state_id next(state_id s) const;
+
+    bool operator==(const state_set& other) const;
+
+    /// Is every state of this set in other (of the same size)?
+    bool subsetOf(const state_set& other) const;
+    bool operator!=(const state_set& other) const { return !(*this == other); }
+
+    /**
+        This set becomes a & b, a | b, !a or !a | b, computed chunk by
+        chunk for operands of any form, and is chunked. a and b must
+        have the size of this set, and either may be this set.
+    */
+    void assignAnd(const state_set& a, const state_set& b);
+    void assignOr(const state_set& a, const state_set& b);
+    void assignNot(const state_set& a);
+    void assignImplies(const state_set& a, const state_set& b);
+
+  private:
+    struct container {
+      enum { ARRAY, BITMAP, RUNS };
+      int key;                      // chunk number
+      int kind;
+      int card;                     // number of states
+      std::vector<uint16_t> vals;   // ARRAY: sorted offsets; RUNS: first and last offset of each run
+      std::vector<word> bits;       // BITMAP: CHUNK_WORDS words
+    };
+    enum bool_op { OP_AND, OP_OR, OP_NOT, OP_IMPLIES };
+
+    size_t lowerChunk(int key) const;
+    bool chunkContains(state_id s) const;
+    void chunkInsert(state_id s);
+    void chunkErase(state_id s);
+    void combine(bool_op op, const state_set& a, const state_set* b);
+    const word* chunkWords(int key, word* buf) const;
+
+    static bool has(const container& c, int low);
+    static int nextIn(const container& c, int low);
+    static void expand(const container& c, word* bits, int nwords);
+    static void encode(const word* bits, container& c);
+    static void toBitmap(container& c);
+
+    int num_states;
+    bool dense;
+    std::vector<word> words;          // dense form
+    std::vector<container> chunks;    // chunked form: the non-empty chunks, by key
+};
+
+/**
+  A finished Kripke structure, in compressed sparse row form.
+
+  The successors of state i are succ[succ_off[i]] .. succ[succ_off[i+1]-1],
+  in increasing order, and its predecessors are likewise in pred. The
+  arrays belong to whoever filled in the struct.
 */
-//class state_set;
+struct kripke_graph {
+  int num_states;
+  int num_arcs;
+  const int* succ_off;
+  const int* succ;
+  const int* pred_off;
+  const int* pred;
+};
 
-typedef std::set<int> state_set;
+/**
+  Work done by labeling operations, counted by a model while it is
+  given one with model::setCounters(). Operations add to the fields,
+  so one op_counters may gather several calls.
+*/
+struct op_counters {
+  long long iterations;   // fixpoint iterations, or states taken off a worklist
+  long long arcs;         // arcs looked at
+  long long bytes;        // bytes of temporary storage allocated
+  op_counters() : iterations(0), arcs(0), bytes(0) { }
+};
 
 class model;  // see below
 
@@ -27,6 +191,14 @@ class model;  // see below
 */
 model* makeEmptyModel(int debug_level);
 
+/**
+
+  Returns a new and empty symbolic model, where the transition
+  relation and every state_set are BDDs. It answers every operation
+  exactly like the model returned by makeEmptyModel().
+*/
+model* makeSymbolicModel(int debug_level);
+
 /**
 
   Abstract class - interface for models and model checking operations.
@@ -37,11 +209,13 @@ model* makeEmptyModel(int debug_level);
 */
 class model {
 
-
+  protected:
+    // where finish() and the like say why they failed
+    std::ostream* messages;
   	
   public:
-    // Empty constructor.
-    model() { }
+    // Messages go to standard output.
+    model() : messages(&std::cout) { }
 
     // Empty destructor (required).
     virtual ~model() {  }
@@ -67,6 +241,36 @@ class model {
     */
     virtual void setNumStates(int n) = 0;
 
+    /**
+        Set the number of threads the labeling operations may use.
+        Called by the parser at most once, right after the model
+        is created. Models that do not run in parallel may ignore it.
+
+          @param  n   Number of threads, 1 for single threaded.
+    */
+    virtual void setNumThreads(int n) { }
+
+    /**
+        The pool on which several labeling operations may run at the
+        same time, each called from a thread of its own (and using the
+        pool itself meanwhile), or 0 if they must run one at a time.
+        By default, 0.
+    */
+    virtual thread_pool* concurrentPool() { return 0; }
+
+    /**
+        Count the work of the labeling operations into c, until
+        called again; 0 (the default) stops counting. Models that
+        do not count may ignore it.
+    */
+    virtual void setCounters(op_counters* c) { }
+
+    /**
+        Write the reasons finish(), setGraph() or changeArcs() fail
+        to out, instead of standard output.
+    */
+    void setMessages(std::ostream* out) { messages = out; }
+
     /**
         Check if the given state is valid.
         Will be called after setNumStates().
@@ -76,6 +280,9 @@ class model {
     */
     virtual bool isValidState(state_id s) = 0;
 
+    /// The number of states, as given to setNumStates().
+    virtual int getNumStates() = 0;
+
     /**
         Add an arc in the Kripke structure,
         from state s1 to state s2.
@@ -87,6 +294,47 @@ class model {
     */
     virtual void addArc(state_id s1, state_id s2) = 0;
 
+    /**
+        Get the arcs of a finished model, e.g. to save them.
+
+          @param  g   Filled with arrays owned by the model.
+          @return     false if the model does not store its arcs
+                      in this form.
+    */
+    virtual bool getGraph(kripke_graph& g) { return false; }
+
+    /**
+        Build the model from a finished structure, instead of
+        setNumStates(), addArc() and finish(); finish() must not be
+        called afterwards. The arrays of g must outlive the model,
+        which may use them in place.
+        By default, the arcs are added one at a time.
+
+          @return     as finish().
+    */
+    virtual bool setGraph(const kripke_graph& g) {
+      setNumStates(g.num_states);
+      for (int s = 0; s < g.num_states; s++) {
+        for (int k = g.succ_off[s]; k < g.succ_off[s+1]; k++) addArc(s, g.succ[k]);
+      }
+      return finish();
+    }
+
+    /**
+        Add and remove arcs of a finished model. The result is checked
+        as by finish(); if the check fails, the model is left unchanged.
+        By default, the arcs of a finished model cannot be changed.
+
+          @param  added     Arcs to add; those already present are ignored.
+          @param  removed   Arcs to remove; each must be present, or in
+                            added, else the model is left unchanged.
+          @return           false if the arcs were not changed.
+    */
+    virtual bool changeArcs(const std::vector<std::pair<state_id, state_id> >& added,
+                            const std::vector<std::pair<state_id, state_id> >& removed) {
+      return false;
+    }
+
     /**
         Create a new, empty, state_set for this model.
     */
@@ -115,6 +363,15 @@ class model {
     */
     virtual void copy(const state_set* sset, state_set* rset) = 0;
 
+    /**
+        Store a set of states in as little memory as the model can.
+        The parser calls this on every label once the labels are read.
+        By default, nothing is done.
+
+          @param  sset  Set of states; its states are unchanged.
+    */
+    virtual void compact(state_set* sset) { }
+
     //
     // Unary operations
     //
@@ -263,7 +520,66 @@ class model {
     virtual bool elementOf(state_id s, const state_set* sset) = 0;
 
     /**
-        Display all states contained in a set to standard output.
+        Number of states in a set.
+        By default, the states of sset as a state_set.
+    */
+    virtual long long cardinality(const state_set* sset) { return sset->count(); }
+
+    /**
+        The states of a set as a bitset: state s is bit s % 64 of
+        words[s / 64], and words holds (getNumStates() + 63) / 64 words.
+    */
+    virtual void getWords(const state_set* sset, std::vector<uint64_t>& words) {
+      words.assign(sset->numWords(), 0);
+      if (!words.empty()) sset->toWords(&words[0]);
+    }
+
+    /**
+        Check if every state of a set is in another.
+        By default, compared as state_sets.
+    */
+    virtual bool isSubset(const state_set* sset1, const state_set* sset2) {
+      return sset1->subsetOf(*sset2);
+    }
+
+    //
+    // Updates, after the arcs or the labels changed
+    //
+
+    /**
+        E p U q, or EF q if sset1 is 0, brought up to date from its value
+        before a change that can only make it grow: arcs added and none
+        removed, states added to p and q and none removed.
+        By default, computed again with EU() or EF().
+
+          @param  check   The states that may have a new path into the
+                          earlier result: the sources of the added arcs,
+                          and the states added to p.
+          @param  rset    On input: E p U q before the change.
+                          On output: E p U q after it.
+    */
+    virtual void EUgrow(const state_set* sset1, const state_set* sset2,
+                        const state_set* check, state_set* rset) {
+      if (sset1) EU(sset1, sset2, rset);
+      else EF(sset2, rset);
+    }
+
+    /**
+        AG p, brought up to date from its value before a change that can
+        only make it shrink: arcs added and none removed, states removed
+        from p and none added.
+        By default, computed again with AG().
+
+          @param  check   The sources of the added arcs.
+          @param  rset    On input: AG p before the change.
+                          On output: AG p after it.
+    */
+    virtual void AGshrink(const state_set* sset, const state_set* check, state_set* rset) {
+      AG(sset, rset);
+    }
+
+    /**
+        Display all states contained in a set to out.
         Output should be a comma separated list of state ids, in order,
         contained in the set.
         For example, output should be
@@ -272,8 +588,9 @@ class model {
           "{S0, S1, S7}"  for a set containing state ids 0, 1, and 7.
 
           @param  sset    Set to display.
+          @param  out     Stream to write to.
     **/
-    virtual void display(const state_set* sset) = 0;
+    virtual void display(const state_set* sset, std::ostream& out) = 0;
     
     
 };
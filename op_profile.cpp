@@ -0,0 +1,97 @@
+
+#include "op_profile.h"
+
+#include <cstdio>
+#include <ostream>
+
+void op_profile::beginFormula(const std::string& text)
+{
+  formulas.push_back(text);
+}
+
+void op_profile::add(call c)
+{
+  if (formulas.empty()) formulas.push_back("");
+  c.formula = formulas.size() - 1;
+  calls.push_back(c);
+}
+
+void op_profile::addTo(totals& t, const call& c)
+{
+  t.calls++;
+  t.ms += c.ms;
+  t.work.iterations += c.work.iterations;
+  t.work.arcs += c.work.arcs;
+  t.work.bytes += c.work.bytes;
+}
+
+// the name goes last, as formulas can be long
+void op_profile::writeRow(std::ostream& out, const totals& t)
+{
+  char buf[128];
+  snprintf(buf, sizeof(buf), "%8lld %12.3f %12lld %12lld %12lld  ",
+      t.calls, t.ms, t.work.iterations, t.work.arcs, t.work.bytes);
+  out << buf << t.name << "\n";
+}
+
+// s as a JSON string
+static std::string quoted(const std::string& s)
+{
+  std::string q = "\"";
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '"' || s[i] == '\\') q += '\\';
+    q += s[i];
+  }
+  return q + "\"";
+}
+
+void op_profile::write(std::ostream& out, int level) const
+{
+  std::vector<totals> by_formula(formulas.size());
+  std::vector<totals> by_op;
+  for (size_t f = 0; f < formulas.size(); f++) {
+    totals t = { formulas[f], 0, 0.0, op_counters() };
+    by_formula[f] = t;
+  }
+  totals all = { "total", 0, 0.0, op_counters() };
+  for (size_t i = 0; i < calls.size(); i++) {
+    const call& c = calls[i];
+    addTo(by_formula[c.formula], c);
+    addTo(all, c);
+    size_t k = 0;
+    while (k < by_op.size() && by_op[k].name != c.op) k++;
+    if (k == by_op.size()) {
+      totals t = { c.op, 0, 0.0, op_counters() };
+      by_op.push_back(t);
+    }
+    addTo(by_op[k], c);
+  }
+
+  char buf[256];
+  if (level <= 1) {
+    // formulas whose subformulas were all evaluated before are left out
+    const char* head = "   calls      time_ms   iterations         arcs        bytes  ";
+    out << head << "formula\n";
+    for (size_t f = 0; f < by_formula.size(); f++) {
+      if (by_formula[f].calls) writeRow(out, by_formula[f]);
+    }
+    out << "\n" << head << "operator\n";
+    for (size_t k = 0; k < by_op.size(); k++) writeRow(out, by_op[k]);
+    writeRow(out, all);
+    return;
+  }
+
+  for (size_t i = 0; i < calls.size(); i++) {
+    const call& c = calls[i];
+    snprintf(buf, sizeof(buf), ", \"op\":\"%s\", \"ms\":%.3f, \"in1\":%lld, \"in2\":%lld, \"out\":%lld, "
+        "\"iterations\":%lld, \"arcs\":%lld, \"bytes\":%lld}\n",
+        c.op, c.ms, c.in1, c.in2, c.out, c.work.iterations, c.work.arcs, c.work.bytes);
+    out << "{\"formula\":" << quoted(formulas[c.formula]) << buf;
+  }
+  for (size_t f = 0; f < by_formula.size(); f++) {
+    const totals& t = by_formula[f];
+    snprintf(buf, sizeof(buf), ", \"calls\":%lld, \"ms\":%.3f, \"iterations\":%lld, \"arcs\":%lld, \"bytes\":%lld}\n",
+        t.calls, t.ms, t.work.iterations, t.work.arcs, t.work.bytes);
+    out << "{\"formula_total\":" << quoted(t.name) << buf;
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef __OP_PROFILE_H__
+#define __OP_PROFILE_H__
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "model.h"
+
+/**
+  Statistics of the labeling operations, collected with -d.
+
+  Each operation run by formula_dag::evaluate() is one call, with its
+  wall time, the number of states of its operands and of its result,
+  and the work counted by the model (see op_counters). A call is
+  charged to the CTL formula being evaluated when it runs, so a
+  subformula shared by several formulas is charged to the first one.
+*/
+class op_profile {
+  public:
+    struct call {
+      int formula;            // index of the formula it is charged to
+      const char* op;
+      double ms;
+      long long in1, in2;     // states of the operands; in2 is -1 for a unary operator
+      long long out;          // states of the result
+      op_counters work;
+    };
+
+    /// Charge the calls from now on to the formula with this text.
+    void beginFormula(const std::string& text);
+
+    /// Record a call, charged to the current formula.
+    void add(call c);
+
+    /**
+        Write the statistics: for level 1, a table of the totals of
+        each formula and of each operator; for higher levels, one JSON
+        object per line for every call, then for every formula.
+    */
+    void write(std::ostream& out, int level) const;
+
+  private:
+    struct totals {
+      std::string name;
+      long long calls;
+      double ms;
+      op_counters work;
+    };
+
+    static void addTo(totals& t, const call& c);
+    static void writeRow(std::ostream& out, const totals& t);
+
+    std::vector<std::string> formulas;
+    std::vector<call> calls;
+};
+
+#endif
@@ -6,14 +6,30 @@
 */
 
 #include <iostream>
+#include <sstream>
 #include <fstream>
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
-#include <stack>
 #include <map>
+#include <mutex>
 #include <cassert>
-
-#include "model.h"
+#include <cstring>
+#include <climits>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "parser.h"
+#include "kripke.h"
+#include "formula_dag.h"
+#include "local_checker.h"
+#include "op_profile.h"
+#include "input_buffer.h"
+#include "ksb.h"
+#include "thread_pool.h"
 
 using namespace std;
 
@@ -36,33 +52,136 @@ typedef enum {
   MODEL=0, LABEL, DISPLAY
 } ctl_formula_type;
 
+struct ctl_instr {
+  ctl_opcode op;
+  int label;      // label id, for OP_LABEL
+  ctl_instr(ctl_opcode o, int l = -1) : op(o), label(l) {}
+};
+
 class ctl_formula {
   ctl_formula_type type;
   public:
   ctl_formula(ctl_formula_type f_type): type(f_type) {}
+  virtual ~ctl_formula() {}
   ctl_formula_type getType() const { return type; }
   virtual void show() = 0;
+  // the formula, for the statistics of -d
+  virtual string text() const = 0;
+  // dag node whose states the query shows, or -1 for an assignment
+  virtual int queryNode() { return -1; }
+  // drop any result kept from before the model changed
+  virtual void forget() { }
 };
 
-map<string, state_set*> str2set;
-state_set* getSet(string label) {
-  return str2set[label];
-}
-void eraseSet(string label) {
-  map<string, state_set*>::iterator iter = str2set.find(label);
-  if (iter != str2set.end()) {
-    str2set.erase(iter);
-  }
-}
-void setSet(string label, state_set* sset) {
-  // only way to over-write is to use a combination of
-  // getSet() and eraseSet(), before using setSet().
-  // also, remember to delete it from the model to avoid memory leaks.
-  //
+/*
+  Label names are interned once, when they are parsed; from then on a
+  label is known by its id, an index into the vectors below.
+
+  The set of a label holds the states it was given in the LABELS
+  section (empty for a label only defined by formulas). Assigning a
+  formula to a label does not touch that set: the label's node moves to
+  the formula's node in the dag instead.
+*/
+class symbol_table {
+  map<string, int> ids;
+  vector<string> names;
+  vector<state_set*> sets;
+  vector<int> nodes;
+  public:
+    // id of a label, a new one if the label was never seen
+    int intern(const string& label) {
+      map<string, int>::iterator iter = ids.find(label);
+      if (iter != ids.end()) return iter->second;
+      ids[label] = names.size();
+      names.push_back(label);
+      sets.push_back(0);
+      nodes.push_back(-1);
+      return names.size() - 1;
+    }
+
+    // id of a label, or -1 if the label was never seen
+    int find(const string& label) const {
+      map<string, int>::const_iterator iter = ids.find(label);
+      return (iter == ids.end()) ? -1 : iter->second;
+    }
+
+    int size() const { return names.size(); }
+
+    // forget every label (their sets are not deleted)
+    void clear() {
+      ids.clear();
+      names.clear();
+      sets.clear();
+      nodes.clear();
+    }
+
+    const string& name(int id) const { return names[id]; }
+
+    state_set* getSet(int id) const { return sets[id]; }
+    void eraseSet(int id) { sets[id] = 0; }
+    void setSet(int id, state_set* sset) {
+      // only way to over-write is to use a combination of
+      // getSet() and eraseSet(), before using setSet().
+      // also, remember to delete it from the model to avoid memory leaks.
+      //
 #ifdef DEBUG
-  assert(str2set[label] == 0);
+      assert(sets[id] == 0);
 #endif
-  str2set[label] = sset;
+      sets[id] = sset;
+    }
+
+    // dag node of the latest formula assigned to a label, or -1
+    int getNode(int id) const { return nodes[id]; }
+    void setNode(int id, int node) { nodes[id] = node; }
+};
+
+/*
+  What a parse builds besides the model. mctool has one; each
+  kripke_context (kripke.h) has its own, and makes it the current one
+  of its thread for the time of each call, so that contexts used from
+  different threads share nothing.
+*/
+struct parse_state {
+  symbol_table symbols;
+  formula_dag* dag;         // all CTL formulas of the input; created along with the model
+  local_checker* local;     // with -l, answers S |= p queries by a search from S; 0 otherwise
+  ostream* out;             // where the results, and the errors in formulas, are written
+  parse_state() : dag(0), local(0), out(&cout) {}
+};
+
+parse_state mctool_state;
+thread_local parse_state* current = &mctool_state;
+
+// makes a parse_state (of a kripke_context, or of a --batch file) the
+// current one of the thread, for the time of a call
+class context_scope {
+  parse_state* saved;
+  public:
+    context_scope(parse_state* s) : saved(current) { current = s; }
+    ~context_scope() { current = saved; }
+};
+
+// node for the current value of a label
+int labelNode(int id) {
+  int node = current->symbols.getNode(id);
+  return (node >= 0) ? node : current->dag->leaf(id, current->symbols.getSet(id));
+}
+
+// states of a label, once all the formulas are parsed
+state_set* labelValue(int id) {
+  return current->dag->evaluate(labelNode(id));
+}
+
+state_set* getSet(const string& label) {
+  int id = current->symbols.find(label);
+  return (id < 0) ? 0 : current->symbols.getSet(id);
+}
+void eraseSet(const string& label) {
+  int id = current->symbols.find(label);
+  if (id >= 0) current->symbols.eraseSet(id);
+}
+void setSet(const string& label, state_set* sset) {
+  current->symbols.setSet(current->symbols.intern(label), sset);
 }
 
 class ctl_formula_models : public ctl_formula {
@@ -70,23 +189,30 @@ class ctl_formula_models : public ctl_formula {
   bool evaluated;
   bool result;
   state_id state;
-  string label;
+  int label;
   public:
     ctl_formula_models()
-    : ctl_formula(MODEL), m(0), evaluated(false), result(false) {}
+    : ctl_formula(MODEL), m(0), evaluated(false), result(false), label(-1) {}
 
     void show() {
-      cout << "S" << state << " |= " << label << ": ";
-      cout << (getResult() ? "Yes" : "No") << endl;
+      *current->out << "S" << state << " |= " << current->symbols.name(label) << ": ";
+      *current->out << (getResult() ? "Yes" : "No") << endl;
     }
 
+    string text() const {
+      return "S" + to_string(state) + " |= " + current->symbols.name(label);
+    }
+
+    int queryNode() { return current->local ? -1 : labelNode(label); }
+
+    void forget() { evaluated = false; }
+
     bool getResult() {
       if (!evaluated) {
         assert(m);
         assert(m->isValidState(state));
-        state_set* sset = getSet(label);
-        assert(sset);
-        result = m->elementOf(state, sset);
+        if (current->local) result = current->local->check(labelNode(label), state);
+        else result = m->elementOf(state, labelValue(label));
         evaluated = true;
       }
       return result;
@@ -102,7 +228,7 @@ class ctl_formula_models : public ctl_formula {
       evaluated = false;
     }
 
-    void setLabel(string l) {
+    void setLabel(int l) {
       label = l;
       evaluated = false;
     }
@@ -110,163 +236,134 @@ class ctl_formula_models : public ctl_formula {
 
 class ctl_formula_displays : public ctl_formula {
   model* m;
-  string label;
+  int label;
   public:
     ctl_formula_displays()
-    : ctl_formula(DISPLAY), m(0) {}
+    : ctl_formula(DISPLAY), m(0), label(-1) {}
 
     void show() {
-      cout << "[[ " << label << " ]]: ";
+      showStates();
+      *current->out << endl;
+    }
+
+    // the states, on one line
+    void showStates() {
+      *current->out << "[[ " << current->symbols.name(label) << " ]]: ";
       assert(m);
-      state_set* sset = getSet(label);
-      assert(sset);
-      m->display(sset);
-      cout << endl;
+      m->display(labelValue(label), *current->out);
+    }
+
+    string text() const {
+      return "[[ " + current->symbols.name(label) + " ]]";
     }
 
+    int queryNode() { return labelNode(label); }
+
     void setModel(model* a_model) { m = a_model; }
 
-    void setLabel(string l) {
+    void setLabel(int l) {
       label = l;
-      assert(getSet(label));
+      assert(current->symbols.getSet(label));
     }
 };
 
-bool isUnaryOperator(string op);
-bool isBinaryOperator(string op);
+const char* instrName(const ctl_instr& in);
 
 class ctl_formula_labels : public ctl_formula {
   model* m;
-  string label;
-  vector<string> formula;
-  bool evaluated;
-  state_set* result;
+  int label;
+  vector<ctl_instr> formula;
+  int root;       // dag node of formula
   public:
   ctl_formula_labels()
-    : ctl_formula(LABEL), m(0), evaluated(false), result(0) {}
+    : ctl_formula(LABEL), m(0), label(-1), root(-1) {}
 
   void show() {
 #ifdef SHOW_FORMULA_LABELS
-    cout << label << " := ";
-    for (int i = 0; i < formula.size(); i++) {
-      cout << " " << formula[i];
+    cout << current->symbols.name(label) << " := ";
+    for (size_t i = 0; i < formula.size(); i++) {
+      cout << " " << instrName(formula[i]);
     }
     cout << " (postfix notation) " << endl;
 #endif
   }
 
-  state_set* getResult() {
-    if (!evaluated) {
-      assert(m);
-      // evaluate formula in postfix
-      // TODO: finish evaluating this expression
-      stack<state_set*> operands;
-      for (int i = 0; i < formula.size(); i++) {
-        string token = formula[i];
-        if (isUnaryOperator(token)) {
-          assert(!operands.empty());
-          state_set* sset = operands.top(); operands.pop();
-          // sset can be over-written with the result,
-          // see operand case
-          if (token == "!") {
-            m->NOT(sset, sset);
-          } else if (token == "EX") {
-            m->EX(sset, sset);
-          } else if (token == "EF") {
-            m->EF(sset, sset);
-          } else if (token == "EG") {
-            m->EG(sset, sset);
-          } else if (token == "AX") {
-            m->AX(sset, sset);
-          } else if (token == "AF") {
-            m->AF(sset, sset);
-          } else {
-            assert(token == "AG");
-            m->AG(sset, sset);
-          }
-          operands.push(sset);
-        } else if (isBinaryOperator(token)) {
-          assert(!operands.empty());
-          state_set* sset2 = operands.top(); operands.pop();
-          assert(!operands.empty());
-          state_set* sset1 = operands.top(); operands.pop();
-          // sset1 and sset2 can be over-written with the result,
-          // see operand case
-          if (token == "&") {
-            m->AND(sset1, sset2, sset1);
-          } else if (token == "|") {
-            m->OR(sset1, sset2, sset1);
-          } else if (token == "->") {
-            m->IMPLIES(sset1, sset2, sset1);
-          } else if (token == "EU") {
-            m->EU(sset1, sset2, sset1);
-          } else {
-            assert(token == "AU");
-            m->AU(sset1, sset2, sset1);
-          }
-          m->deleteSet(sset2);
-          operands.push(sset1);
-        } else {
-          // operand, or label, put on top of stack
-          state_set* sset = getSet(formula[i]);
-          state_set* rset = m->makeEmptySet();
-          m->copy(sset, rset);
-          operands.push(rset);
-        }
-      }
-
-      assert(!operands.empty());
-      result = operands.top(); operands.pop();
-
-      // write result to label (over-write if necessary)
-      state_set* label_sset = getSet(label);
-      if (label_sset != result) {
-        eraseSet(label);
-        if (label_sset != 0) m->deleteSet(label_sset);
-        setSet(label, result);
-      }
-    
-      evaluated = true;
+  // in postfix notation
+  string text() const {
+    string t = current->symbols.name(label) + " :=";
+    for (size_t i = 0; i < formula.size(); i++) {
+      t += " ";
+      t += instrName(formula[i]);
     }
-    return result;
+    return t;
   }
 
-  void setModel(model* a_model) {
-    if (result) { m->deleteSet(result); result = 0; }
-    m = a_model;
-    evaluated = false;
+  // the result is owned by the dag, and shared with every other
+  // formula that has the same subformula
+  state_set* getResult() {
+    assert(m);
+    assert(root >= 0);
+    return current->dag->evaluate(root);
   }
 
-  void setLabel(string l) {
+  void setModel(model* a_model) { m = a_model; }
+
+  void setLabel(int l) {
     assert(m);
-    if (result) { m->deleteSet(result); result = 0; }
     label = l;
-    evaluated = false;
-    if (0 == getSet(label)) {
-      setSet(label, m->makeEmptySet());
+    if (0 == current->symbols.getSet(label)) {
+      current->symbols.setSet(label, m->makeEmptySet());
     }
   }
 
-  void setFormula(vector<string>& f) {
-    if (result) { m->deleteSet(result); result = 0; }
+  int rootNode() const { return root; }
+
+  void setFormula(vector<ctl_instr>& f, int node) {
     formula = f;
-    evaluated = false;
+    root = node;
   }
+
+  // from here on, the label refers to this formula: once the
+  // statement is complete
+  void assign() { current->symbols.setNode(label, root); }
 };
 
 
-bool read_integer(string& line, int& i, int& integer) {
+/*
+  One line of the input, in place in the input buffer (without its
+  newline). The read_* functions below tokenize it directly: they never
+  copy the rest of the line, and only a label is ever made into a string.
+*/
+struct line_view {
+  const char* data;
+  int len;
+  line_view(const char* d, int l) : data(d), len(l) {}
+  char operator[](int i) const { return data[i]; }
+  int size() const { return len; }
+};
+
+ostream& operator<<(ostream& out, const line_view& line) {
+  return out.write(line.data, line.len);
+}
+
+
+bool read_integer(const line_view& line, int& i, int& integer) {
   if (i < line.size() && isdigit(line[i])) {
-    string::size_type sz;
-    integer = stoi(line.substr(i), &sz);
-    i = (sz == string::npos)? line.size()-1: i+sz-1;
+    int value = 0, j = i;
+    for (; j < line.size() && isdigit(line[j]); j++) {
+      int digit = line[j] - '0';
+      if (value > (INT_MAX - digit) / 10) return false;   // does not fit
+      value = value * 10 + digit;
+    }
+    integer = value;
+    i = j-1;    // i points to the last digit
     return true;
   }
   return false;
 }
 
 
-bool read_state_id(string& line, int& i, int& state_id) {
+bool read_state_id(const line_view& line, int& i, int& state_id) {
   if (line[i] == 's' || line[i] == 'S') {
     ++i;
     return read_integer(line, i, state_id);
@@ -275,48 +372,48 @@ bool read_state_id(string& line, int& i, int& state_id) {
 }
 
 
-bool read_string(string& line, int& i, const string& match) {
-  if (line.substr(i, match.size()) != match) return false;
-  i += match.size() - 1;
+bool read_string(const line_view& line, int& i, const char* match) {
+  int len = strlen(match);
+  if (line.size() - i < len || memcmp(line.data + i, match, len) != 0) return false;
+  i += len - 1;
   return true;
 }
 
 
-bool read_label(string& line, int& i, string& str) {
+bool read_label(const line_view& line, int& i, string& str) {
   if (i >= line.size()) return false;
   if (!isalpha(line[i])) return false;
   int start = i++;
   while (i < line.size() && (isalnum(line[i]) || line[i] == '_')) i++;
-  str = line.substr(start, i-start);
+  str.assign(line.data + start, i - start);
   i--;    // i points to the last character of the string
   return true;
 }
 
 
-int opToVal(string op) {
-  return
-    op == "->"? 0
-    : op == "|"? 1
-    : op == "&"? 2
-    : (op == "AU" || op == "EU")? 3
-    : (op == "!" || op == "AX" || op == "AF" || op == "AG" || op == "EX" || op == "EF" || op == "EG")? 4
-    : -1;
+int opToVal(ctl_opcode op) {
+  switch (op) {
+    case OP_IMPLIES:  return 0;
+    case OP_OR:       return 1;
+    case OP_AND:      return 2;
+    case OP_AU:
+    case OP_EU:       return 3;
+    case OP_NOT:
+    case OP_AX: case OP_AF: case OP_AG:
+    case OP_EX: case OP_EF: case OP_EG:
+                      return 4;
+    default:          return -1;
+  }
 }
 
 
-bool isUnaryOperator(string op) {
-  return (op == "!"
-      || op == "AX" || op == "AF" || op == "AG"
-      || op == "EX" || op == "EF" || op == "EG");
-}
-
-bool isBinaryOperator(string op) {
-  return (op == "&" || op == "|" || op == "->" || op == "EU" || op == "AU");
+const char* instrName(const ctl_instr& in) {
+  return (in.op == OP_LABEL) ? current->symbols.name(in.label).c_str() : opName(in.op);
 }
 
 
 // op1 is on the operator stack and op2 is the newly discovered operator
-bool isHigherPrecedence(string op1, string op2) {
+bool isHigherPrecedence(ctl_opcode op1, ctl_opcode op2) {
   // Precedence: ascending order
   // ->
   // |
@@ -334,33 +431,47 @@ bool isHigherPrecedence(string op1, string op2) {
 }
 
 
-bool read_ctl_operator(string& line, int& i, string& op) {
+// on success, len is the number of characters of the operator
+bool read_ctl_operator(const line_view& line, int& i, ctl_opcode& op, int& len) {
   if (i >= line.size()) return false;
-  if (line[i] == '!' || line[i] == '&' || line[i] == '|') {
-    op = line[i]; return true;
+  len = 1;
+  switch (line[i]) {
+    case '!': op = OP_NOT; return true;
+    case '&': op = OP_AND; return true;
+    case '|': op = OP_OR;  return true;
   }
   // for the rest of the ctl operators the line must have atleast two characters
   if (i+1 < line.size()) {
-    if (line[i] == 'A' || line[i] == 'E') {
-      if (line[i+1] == 'X' || line[i+1] == 'F' || line[i+1] == 'G') {
-        op = line.substr(i, 2); return true;
+    char c = line[i], d = line[i+1];
+    if (c == 'A' || c == 'E') {
+      len = 2;
+      switch (d) {
+        case 'X': op = (c == 'A') ? OP_AX : OP_EX; return true;
+        case 'F': op = (c == 'A') ? OP_AF : OP_EF; return true;
+        case 'G': op = (c == 'A') ? OP_AG : OP_EG; return true;
       }
-      if (isspace(line[i+1]) || line[i+1] == '(') {
-        op = line[i]; return true;
+      len = 1;
+      if (isspace(d) || d == '(') {
+        op = (c == 'A') ? OP_A : OP_E; return true;
       }
     }
-    if (line[i] == 'U' && (isspace(line[i+1]) || line[i+1] == '(')) {
-      op = line[i]; return true;
+    if (c == 'U' && (isspace(d) || d == '(')) {
+      op = OP_U; return true;
     }
-    if (line.substr(i, 2) == "->") {
-      op = "->"; return true;
+    if (c == '-' && d == '>') {
+      op = OP_IMPLIES; len = 2; return true;
     }
   }
   return false;
 }
 
 
-bool read_formula(string& line, int& i, vector<string>& postfix) {
+/*
+  Read a formula, up to the next ';', into postfix. On a syntax error,
+  returns false, with i at the token in error; expecting says what was
+  expected there, if more can be said than "CTL formula".
+*/
+bool read_formula(const line_view& line, int& i, vector<ctl_instr>& postfix, const char*& expecting) {
   if (i >= line.size()) return false;
   /*
    * Parsing a formula:
@@ -374,70 +485,69 @@ bool read_formula(string& line, int& i, vector<string>& postfix) {
    *                . while stack.top() is a operator of equal or higher precedence,
    *                        . pop the operator and append to postfix vector.
    *                . push operator onto operator stack.
-   *        . If operand, append to postfix vector.
+   *        . If operand, append its label id to postfix vector.
    */
 
 #ifdef DEBUG_FORMULA
   cout << "Reading new formula" << endl;
 #endif
-  stack<string> operators;
+  vector<ctl_opcode> operators;
   while (i < line.size() && line[i] != ';') {
     if (isspace(line[i])) { i++; continue; }
 
     if (line[i] == '(') {
-      operators.push("("); i++; continue;
+      operators.push_back(OP_LPAREN); i++; continue;
     }
     if (line[i] == ')') {
-      while (!operators.empty() && operators.top() != "(")  {
-        postfix.push_back(operators.top());
-        operators.pop();
+      while (!operators.empty() && operators.back() != OP_LPAREN)  {
+        postfix.push_back(operators.back());
+        operators.pop_back();
       }
       if (operators.empty()) {
         // Did not find a matching "(" in the operators stack, signal error
-        cout << "Syntax error: ) found without a matching ( " << endl;
+        expecting = "a ( before )";
         return false;
       }
-      operators.pop(); i++; continue;
+      operators.pop_back(); i++; continue;
     }
 
     // could be a CTL operator
-    string op;
-    if (read_ctl_operator(line, i, op)) {
+    ctl_opcode op;
+    int len;
+    if (read_ctl_operator(line, i, op, len)) {
 #ifdef DEBUG_FORMULA
-      cout << endl << "Found CTL operator: " << op << endl;
+      cout << endl << "Found CTL operator: " << opName(op) << endl;
 #endif
-      if (op == "A" || op == "E") {
-        operators.push(op); i++; continue;
-      } else if (op == "U") {
+      if (op == OP_A || op == OP_E) {
+        operators.push_back(op); i++; continue;
+      } else if (op == OP_U) {
         // special case: A U, E U
         while (!operators.empty()
-            && operators.top() != "("
-            && operators.top() != "A"
-            && operators.top() != "E") {
-          postfix.push_back(operators.top());
-          operators.pop();
+            && operators.back() != OP_LPAREN
+            && operators.back() != OP_A
+            && operators.back() != OP_E) {
+          postfix.push_back(operators.back());
+          operators.pop_back();
         }
-        // operators.top() must be either A or E
+        // operators.back() must be either A or E
         if (operators.empty()
-            || (operators.top() != "A" && operators.top() != "E")) {
+            || (operators.back() != OP_A && operators.back() != OP_E)) {
           // Did not find a matching A or E in the operators stack, signal error
-          cout << "Syntax error: U found without a matching A or E" << endl;
+          expecting = "A or E before U";
           return false;
         }
-        op = operators.top() + op;
-        operators.pop();
-        operators.push(op);
+        operators.back() = (operators.back() == OP_A) ? OP_AU : OP_EU;
         i++; continue;
       } else {
         while (!operators.empty()
-            && operators.top() != "("
-            && operators.top() != "A"
-            && operators.top() != "E"
-            && isHigherPrecedence(operators.top(), op)) {
-          postfix.push_back(operators.top());
-          operators.pop();
+            && operators.back() != OP_LPAREN
+            && operators.back() != OP_A
+            && operators.back() != OP_E
+            && isHigherPrecedence(operators.back(), op)) {
+          postfix.push_back(operators.back());
+          operators.pop_back();
         }
-        operators.push(op); i += op.size(); continue;
+        operators.push_back(op); i += len; continue;
       }
     }
 
@@ -445,23 +555,24 @@ bool read_formula(string& line, int& i, vector<string>& postfix) {
     string label;
     if (!read_label(line, i, label)) return false;
 
-    if (getSet(label) == 0) {
+    int id = current->symbols.find(label);
+    if (id < 0 || current->symbols.getSet(id) == 0) {
       // error: unknown label
-      cout << "Syntax error: previously undeclared label " << label << endl;
+      expecting = "a previously declared label";
       i = i+1-label.size();
       return false;
     }
 
-    postfix.push_back(label);
+    postfix.push_back(ctl_instr(OP_LABEL, id));
     i++;
     // i += label.size();
   }
 
-  while(!operators.empty()) { postfix.push_back(operators.top()); operators.pop(); }
+  while(!operators.empty()) { postfix.push_back(operators.back()); operators.pop_back(); }
 
 #ifdef DEBUG_FORMULA
-  for (int j = 0; j < postfix.size(); j++) {
-    cout << postfix[j] << " ";
+  for (size_t j = 0; j < postfix.size(); j++) {
+    cout << instrName(postfix[j]) << " ";
   }
   cout << endl;
   cout << i << ": " << line[i] << endl;
@@ -473,8 +584,32 @@ bool read_formula(string& line, int& i, vector<string>& postfix) {
 }
 
 
+/*
+  Hash-cons a formula, in postfix, into the dag; returns its node, or
+  -1 if the formula is not well formed. Labels are resolved now, so a
+  label that is reassigned later still means its current value here.
+*/
+int compile_formula(const vector<ctl_instr>& postfix) {
+  vector<int> operands;
+  for (size_t i = 0; i < postfix.size(); i++) {
+    const ctl_instr& in = postfix[i];
+    if (in.op == OP_LABEL) {
+      operands.push_back(labelNode(in.label));
+    } else if (isUnaryOperator(in.op) && operands.size() >= 1) {
+      operands.back() = current->dag->apply(in.op, operands.back());
+    } else if (isBinaryOperator(in.op) && operands.size() >= 2) {
+      int node2 = operands.back(); operands.pop_back();
+      operands.back() = current->dag->apply(in.op, operands.back(), node2);
+    } else {
+      return -1;
+    }
+  }
+  return (operands.size() == 1) ? operands.back() : -1;
+}
+
+
 void syntax_error(ostream& out, const string& str, int line_number, int col_number,
-  const string& line) {
+  const line_view& line) {
   out << "Syntax error: expecting " << str
     << " at line: " << line_number
     << " and col: " << col_number << endl;
@@ -484,275 +619,693 @@ void syntax_error(ostream& out, const string& str, int line_number, int col_numb
 }
 
 
-// parse the input source
-model* parse_tokens(int debug_level, istream& source_stream) {
-  model* m = 0;
-  int num_states = 0;
-  state_id s1, s2;
-  string line;
-  string label;
-  vector<ctl_formula*> ctl_formulas;
-  ctl_formula* current_formula = 0;
-  state_set* sset = 0;
-  vector<string> formula;
-  fsm_state current_state = INIT;
-  int line_number = 0;
+// make a new model, explicit or symbolic
+model* new_model(const mc_options& opts) {
+  model* m = opts.symbolic ? makeSymbolicModel(opts.debug_level)
+                           : makeEmptyModel(opts.debug_level);
+  if (m) m->setNumThreads(opts.num_threads);
+  return m;
+}
 
 
+// save a finished model, and the labels of its LABELS section
+void export_ksb(const char* path, model* m) {
+  kripke_graph g;
+  if (!m->getGraph(g)) {
+    cout << "Error: this model cannot be saved as " << path << endl;
+    exit(1);
+  }
+  vector<string> names;
+  vector<const state_set*> sets;
+  for (int id = 0; id < current->symbols.size(); id++) {
+    if (current->symbols.getSet(id)) {
+      names.push_back(current->symbols.name(id));
+      sets.push_back(current->symbols.getSet(id));
+    }
+  }
+  string error;
+  if (!writeKSB(path, g, names, sets, error)) {
+    cout << "Error: " << error << endl;
+    exit(1);
+  }
+}
 
-  while (getline(source_stream, line)) {
-    line_number++;
-    for (int i=0; i<line.size(); i++) {
-      if (line[i] == '#') break;        // comment; ignore rest of line
-      if (isspace(line[i])) continue;   // whitespace; skip
 
-      switch (current_state) {
-        case INIT:
-          // expecting "KRIPKE"
-          if (!read_string(line, i, "KRIPKE")) {
-            syntax_error(cout, "keyword KRIPKE", line_number, i, line);
-            exit(1);
-          }
-#ifdef DEBUG
-          cout << "KRIPKE" << endl;
-#endif
-          current_state = KRIPKE;
-          m = makeEmptyModel(debug_level);
-          if (0==m) return m;
-          break;
+// give a new model the arcs and the labels of a .ksb file; false if
+// the arcs do not make a valid model
+bool read_ksb(model* m, const ksb_reader& ksb) {
+  if (!m->setGraph(ksb.graph())) return false;
+  for (int i = 0; i < ksb.numLabels(); i++) {
+    state_set* sset = m->makeEmptySet();
+    const uint64_t* words = ksb.labelWords(i);
+    if (sset->size() == ksb.graph().num_states) {
+      sset->makeDense();
+      memcpy(sset->data(), words, ksb.wordsPerSet() * sizeof(uint64_t));
+      m->compact(sset);
+    } else {
+      for (int s = 0; s < ksb.graph().num_states; s++) {
+        if (words[s / 64] >> (s % 64) & 1) m->addState(s, sset);
+      }
+    }
+    setSet(ksb.labelName(i), sset);
+  }
+  return true;
+}
 
-        case KRIPKE:
-          // expecting "STATES"
-          if (!read_string(line, i, "STATES")) {
-            syntax_error(cout, "keyword STATES", line_number, i, line);
-            exit(1);
-          }
-#ifdef DEBUG
-          cout << "STATES";
-#endif
-          current_state = STATES;
-          break;
 
-        case STATES:
-          // expecting an integer
-          if (!read_integer(line, i, num_states)) {
-            syntax_error(cout, "an integer", line_number, i, line);
-            exit(1);
-          }
-#ifdef DEBUG
-          cout << " " << num_states;
-#endif
-          current_state = INTEGER;
-          m->setNumStates(num_states);
-          break;
+// build a model, and its labels, from a .ksb file
+model* load_ksb(const mc_options& opts, const ksb_reader& ksb) {
+  model* m = new_model(opts);
+  if (0==m) return m;
+  if (!read_ksb(m, ksb)) {
+    cout << "Error: Kripke structure failed to finish\n";
+    exit(1);
+  }
+  return m;
+}
 
-        case INTEGER:
-          // expecting ARCS
-          if (!read_string(line, i, "ARCS")) {
-            syntax_error(cout, "keyword ARCS", line_number, i, line);
-            exit(1);
-          }
-#ifdef DEBUG
-          cout << endl << "ARCS" << endl;
-#endif
-          current_state = ARCS;
-          break;
 
+/*
+  The ARCS and LABELS sections are parsed apart from the rest, in
+  chunks that may run on several threads: the bulk of a large input is
+  there, and arcs and labels are simple enough to be split at any ';'.
+
+  A chunk is parsed as if it started at the beginning of an arc (or of
+  a label) outside of any comment; the merge then checks this against
+  the state the previous chunk really ended in, and parses the chunk
+  again from there if it was wrong (a ';' inside a comment). Chunks record what
+  they found, and the merge replays it in input order, so the model and
+  the labels end up exactly as if the section was parsed in one go.
+*/
+
+// where the parse of a section is, between two characters
+struct section_state {
+  fsm_state state;
+  bool in_comment;    // the current line is a comment from here on
+  state_id s1, s2;    // current arc, or s1 is the current state of a label
+  string label;       // current label
+  section_state(fsm_state st) : state(st), in_comment(false), s1(0), s2(0) {}
+};
+
+// applies what a section parser reads to the model and the labels
+class section_builder {
+  model* m;
+  string label;
+  state_set* sset;
+  bool any_state;
+  public:
+    section_builder(model* a_model) : m(a_model), sset(0), any_state(false) {}
+
+    void arc(state_id s1, state_id s2) { m->addArc(s1, s2); }
+
+    // label: (the old states of a label are kept)
+    void beginLabel(const string& l) {
+      label = l;
+      any_state = false;
+      sset = getSet(label);
+      eraseSet(label);
+      if (sset == 0) {
+        sset = m->makeEmptySet();
+        setSet(label, sset);
+      }
+    }
+
+    void labelState(state_id s) {
+      m->addState(s, sset);
+      any_state = true;
+    }
+
+    // ; at the end of a label
+    void endLabel() {
+      if (any_state) setSet(label, sset);
+      sset = 0;
+    }
+};
+
+// records what a section parser reads, to replay it later
+class section_events {
+  enum { BEGIN_LABEL = -1, END_LABEL = -2 };
+  vector< pair<state_id, state_id> > arcs;
+  vector<state_id> labels;      // states, and BEGIN_LABEL or END_LABEL
+  vector<string> names;         // one for every BEGIN_LABEL
+  public:
+    void arc(state_id s1, state_id s2) { arcs.push_back(make_pair(s1, s2)); }
+    void beginLabel(const string& l) { labels.push_back(BEGIN_LABEL); names.push_back(l); }
+    void labelState(state_id s) { labels.push_back(s); }
+    void endLabel() { labels.push_back(END_LABEL); }
+
+    void replay(section_builder& b) const {
+      for (size_t k = 0; k < arcs.size(); k++) b.arc(arcs[k].first, arcs[k].second);
+      size_t n = 0;
+      for (size_t k = 0; k < labels.size(); k++) {
+        if (labels[k] == BEGIN_LABEL) b.beginLabel(names[n++]);
+        else if (labels[k] == END_LABEL) b.endLabel();
+        else b.labelState(labels[k]);
+      }
+    }
+};
+
+// one chunk of a section, and how its parse ended
+struct section_chunk {
+  const char* begin;
+  const char* end;
+  section_state st;           // at begin, then where the parse stopped
+  const char* stop;           // just past the keyword ending the section, or 0
+  const char* error;          // first syntax error, or 0
+  const char* expecting;      // what the syntax error expected
+  int newlines;               // before stop, error, or end
+  const char* line_start;     // of the last line started, or 0 if all on the first one
+  bool skipped;               // never parsed: an earlier chunk ends the section
+  int num_states;             // of the model: the states a label may have
+  section_events events;
+
+  section_chunk(const char* b, const char* e, const section_state& s, int n)
+  : begin(b), end(e), st(s), stop(0), error(0), expecting(0),
+    newlines(0), line_start(0), skipped(false), num_states(n) {}
+};
+
+/*
+  Parse a chunk, from state c.st, until the end of the chunk, the first
+  syntax error, or the keyword that starts the next section (LABELS in
+  ARCS, CTL in LABELS).
+*/
+template <class SINK>
+void parse_section_chunk(section_chunk& c, SINK& sink) {
+  section_state& st = c.st;
+  const char* p = c.begin;
+  while (p < c.end) {
+    const char* eol = static_cast<const char*>(memchr(p, '\n', c.end - p));
+    line_view line(p, (eol ? eol : c.end) - p);
+    for (int i = st.in_comment ? line.size() : 0; i < line.size(); i++) {
+      if (line[i] == '#') { st.in_comment = true; break; }
+      if (isspace(line[i])) continue;
+
+#define SECTION_ERROR(what) { c.error = line.data + i; c.expecting = what; return; }
+      switch (st.state) {
         case ARCS:
           // expecting LABELS or a state (s1)
           if (read_string(line, i, "LABELS")) {
-            current_state = LABELS;
-#ifdef DEBUG
-            cout << "LABELS" << endl;
-#endif
-          } else if (read_state_id(line, i, s1)) {
-            current_state = ARCS_S1;
-#ifdef DEBUG
-            cout << "  " << s1;
-#endif
-          } else  {
-            syntax_error(cout, "keyword LABELS or a state (S*)", line_number, i, line);
-            exit(1);
-          }
+            st.state = LABELS;
+            c.stop = line.data + i + 1;
+            return;
+          } else if (read_state_id(line, i, st.s1)) {
+            st.state = ARCS_S1;
+          } else SECTION_ERROR("keyword LABELS or a state (S*)");
           break;
 
         case ARCS_S1:
           // expecting '->'
-          if (!read_string(line, i, "->")) {
-            syntax_error(cout, "->", line_number, i, line);
-            exit(1);
-          }
-#ifdef DEBUG
-          cout << " ->";
-#endif
-          current_state = ARCS_ARROW;
+          if (!read_string(line, i, "->")) SECTION_ERROR("->");
+          st.state = ARCS_ARROW;
           break;
 
         case ARCS_ARROW:
           // expecting a state (s2)
-          if (!read_state_id(line, i, s2)) {
-            syntax_error(cout, "state (S*)", line_number, i, line);
-            exit(1);
-          }
-#ifdef DEBUG
-          cout << "  " << s2;
-#endif
-          current_state = ARCS_S2;
+          if (!read_state_id(line, i, st.s2)) SECTION_ERROR("state (S*)");
+          st.state = ARCS_S2;
           break;
 
         case ARCS_S2:
           // expecting ';'
-          if (!read_string(line, i, ";")) {
-            syntax_error(cout, ";", line_number, i, line);
-            exit(1);
-          }
-#ifdef DEBUG
-          cout << ";" << endl;
-#endif
-          current_state = ARCS;
-          m->addArc(s1, s2);
+          if (!read_string(line, i, ";")) SECTION_ERROR(";");
+          st.state = ARCS;
+          sink.arc(st.s1, st.s2);
           break;
 
         case LABELS:
           // expecting CTL or a label
           if (read_string(line, i, "CTL")) {
-            current_state = CTL;
-#ifdef DEBUG
-            cout << "CTL" << endl;
-#endif
-            if (!m->finish()) {
-              cout << "Error: Kripke structure failed to finish\n";
-              exit(1);
-            }
-          } else if (read_label(line, i, label)) {
-            current_state = LABELS_L;
-#ifdef DEBUG
-            cout << "  " << label;
-#endif
-          } else  {
-            syntax_error(cout, "keyword CTL or a label", line_number, i, line);
-            exit(1);
-          }
+            st.state = CTL;
+            c.stop = line.data + i + 1;
+            return;
+          } else if (read_label(line, i, st.label)) {
+            st.state = LABELS_L;
+          } else SECTION_ERROR("keyword CTL or a label");
           break;
 
         case LABELS_L:
           // expecting ':'
-          if (!read_string(line, i, ":")) {
-            syntax_error(cout, ":", line_number, i, line);
-            exit(1);
-          }
-#ifdef DEBUG
-          cout << ":";
-#endif
-          current_state = LABELS_COLON;
-          sset = getSet(label);
-          eraseSet(label);
-          if (sset == 0) {
-            sset = m->makeEmptySet();
-            setSet(label, sset);
-          }
+          if (!read_string(line, i, ":")) SECTION_ERROR(":");
+          st.state = LABELS_COLON;
+          sink.beginLabel(st.label);
           break;
 
         case LABELS_COLON:
           // expecting a state or ';'
-          if (read_state_id(line, i, s1)) {
-            current_state = LABELS_S;
-#ifdef DEBUG
-            cout << " " << s1;
-#endif
-            m->addState(s1, sset);
+          if (read_state_id(line, i, st.s1)) {
+            if (st.s1 >= c.num_states) SECTION_ERROR("a valid state");
+            st.state = LABELS_S;
+            sink.labelState(st.s1);
           } else if (read_string(line, i, ";")) {
-            current_state = LABELS;
-#ifdef DEBUG
-            cout << " ;" << endl;
-#endif
-            sset = 0;
-          } else  {
-            syntax_error(cout, "a state (S*) or ;", line_number, i, line);
-            exit(1);
-          }
+            st.state = LABELS;
+            sink.endLabel();
+          } else SECTION_ERROR("a state (S*) or ;");
           break;
 
         case LABELS_S:
           // expecting a ',' or ';'
           if (read_string(line, i, ",")) {
-            current_state = LABELS_COMMA;
-#ifdef DEBUG
-            cout << " ,";
-#endif
+            st.state = LABELS_COMMA;
           } else if (read_string(line, i, ";")) {
-            current_state = LABELS;
-#ifdef DEBUG
-            cout << " ;" << endl;
-#endif
-			setSet(label, sset); //
-            sset = 0;
-          } else  {
-            syntax_error(cout, ", or ;", line_number, i, line);
-            exit(1);
-          }
+            st.state = LABELS;
+            sink.endLabel();
+          } else SECTION_ERROR(", or ;");
           break;
 
         case LABELS_COMMA:
           // expecting a state
-          if (!read_state_id(line, i, s1)) {
-            syntax_error(cout, "state (S*)", line_number, i, line);
-            exit(1);
-          }
-          current_state = LABELS_S;
-#ifdef DEBUG
-          cout << " " << s1;
-#endif
-          m->addState(s1, sset);
+          if (!read_state_id(line, i, st.s1)) SECTION_ERROR("state (S*)");
+          if (st.s1 >= c.num_states) SECTION_ERROR("a valid state");
+          st.state = LABELS_S;
+          sink.labelState(st.s1);
           break;
 
-        case CTL:
-          // expecting state, label or '[[' 
-          formula.clear();
+        default:
+          exit(1);
+      }
+#undef SECTION_ERROR
+    }
+    if (0 == eol) break;    // the line goes on in the next chunk
+    st.in_comment = false;
+    c.newlines++;
+    p = eol + 1;
+    c.line_start = p;
+  }
+}
 
-          if (read_state_id(line, i, s1)) {
-            current_state = CTL_S;
-#ifdef DEBUG
-            cout << "  " << s1;
-#endif
-            if (!m->isValidState(s1)) {
-              syntax_error(cout, "a valid state", line_number, i, line);
-              exit(1);
-            }
-            ctl_formula_models* temp = new ctl_formula_models;
-            temp->setModel(m);
-            temp->setState(s1);
-            current_formula = temp;
-          } else if (read_label(line, i, label)) {
-            current_state = CTL_L;
-#ifdef DEBUG
-            cout << "  " << label;
-#endif
-            ctl_formula_labels* temp = new ctl_formula_labels;
-            temp->setModel(m);
-            temp->setLabel(label);
-            current_formula = temp;
-          } else if (read_string(line, i, "[[")) {
-            current_state = CTL_SET_OPEN;
-#ifdef DEBUG
-            cout << "  [[";
-#endif
-            ctl_formula_displays* temp = new ctl_formula_displays;
-            temp->setModel(m);
-            current_formula = temp;
-          } else  {
-            syntax_error(cout, "a state, a label, or [[", line_number, i, line);
-            exit(1);
-          }
-          break;
+// how the parse of a section ended
+struct section_result {
+  fsm_state state;            // LABELS or CTL after the keyword, as found at EOF otherwise
+  const char* stop;           // just past the keyword, or 0 at EOF
+  const char* error;          // syntax error, or 0
+  const char* expecting;
+  int newlines;               // from begin to stop (or error)
+  const char* line_start;     // of the line of stop (or error)
+};
 
-        case CTL_S:
-          // expecting '|='
-          if (!read_string(line, i, "|=")) {
-            syntax_error(cout, "|=", line_number, i, line);
-            exit(1);
-          }
-          current_state = CTL_MODELS;
+/*
+  Parse the section starting in state st (ARCS or LABELS) at begin,
+  which is on the line starting at line_start. With more than one
+  thread and enough input, in chunks on a thread pool.
+*/
+section_result parse_section(const mc_options& opts, model* m, fsm_state st,
+  const char* begin, const char* line_start, const char* end) {
+  const size_t min_chunk = 1 << 18;
+  size_t len = end - begin;
+  int num_chunks = 1;
+  if (opts.num_threads > 1) {
+    num_chunks = min<size_t>(4 * opts.num_threads, len / min_chunk);
+    if (num_chunks < 1) num_chunks = 1;
+  }
+
+  // split at the first ';' after every 1/num_chunks of the input
+  vector<section_chunk> chunks;
+  const char* b = begin;
+  for (int k = 1; k < num_chunks; k++) {
+    const char* target = begin + len / num_chunks * k;
+    if (target <= b) continue;
+    const char* semi = static_cast<const char*>(memchr(target, ';', end - target));
+    if (0 == semi) break;
+    chunks.push_back(section_chunk(b, semi + 1, section_state(st), m->getNumStates()));
+    b = semi + 1;
+  }
+  chunks.push_back(section_chunk(b, end, section_state(st), m->getNumStates()));
+
+  if (chunks.size() > 1) {
+    thread_pool pool(opts.num_threads);
+    atomic<int> first_stop(chunks.size());
+    pool.parallel_for(0, chunks.size(), 1, [&](int lo, int hi) {
+      for (int k = lo; k < hi; k++) {
+        if (first_stop.load() < k) { chunks[k].skipped = true; continue; }
+        parse_section_chunk(chunks[k], chunks[k].events);
+        if (chunks[k].stop || chunks[k].error) {
+          int f = first_stop.load();
+          while (k < f && !first_stop.compare_exchange_weak(f, k)) { }
+        }
+      }
+    });
+  }
+
+  // merge, in order
+  section_builder builder(m);
+  section_result r;
+  r.newlines = 0;
+  r.line_start = line_start;
+  section_state state(st);
+  for (size_t k = 0; k < chunks.size(); k++) {
+    if (chunks.size() == 1) {
+      parse_section_chunk(chunks[k], builder);
+    } else if (chunks[k].skipped || state.state != st || state.in_comment) {
+      // this chunk was not parsed from the state the previous one
+      // ended in: parse it again, from there
+      section_chunk again(chunks[k].begin, chunks[k].end, state, m->getNumStates());
+      parse_section_chunk(again, builder);
+      chunks[k] = again;
+    } else {
+      chunks[k].events.replay(builder);
+    }
+    const section_chunk& c = chunks[k];
+    r.newlines += c.newlines;
+    if (c.line_start) r.line_start = c.line_start;
+    state = c.st;
+    r.stop = c.stop;
+    r.error = c.error;
+    r.expecting = c.expecting;
+    if (c.stop || c.error) break;
+  }
+  r.state = state.state;
+  return r;
+}
+
+
+// with -l, a local checker for the model as it is now
+void new_local_checker(const mc_options& opts, model* m, op_profile& profile) {
+  delete current->local;
+  current->local = 0;
+  kripke_graph g;
+  if (opts.local && m->getGraph(g)) {
+    current->local = new local_checker(m, current->dag, g);
+    if (opts.debug_level > 0) current->local->setProfile(&profile);
+  }
+}
+
+
+// with -j, evaluate every node the queries read (and with -a, the
+// assignments) at once, so that independent formulas run side by side
+// on the model's threads; the results are still shown in input order.
+// Not when profiling: each operation is charged to the formula shown.
+void evaluate_ahead(const mc_options& opts, const vector<ctl_formula*>& ctl_formulas) {
+  if (opts.num_threads < 2 || opts.debug_level > 0) return;
+  vector<int> roots;
+  for (size_t i = 0; i < ctl_formulas.size(); i++) {
+    int id = ctl_formulas[i]->queryNode();
+    if (opts.evaluate_all && ctl_formulas[i]->getType() == LABEL) {
+      id = static_cast<ctl_formula_labels*>(ctl_formulas[i])->rootNode();
+    }
+    if (id >= 0) roots.push_back(id);
+  }
+  current->dag->evaluateAll(roots);
+}
+
+
+// show the results of the CTL section, in input order; the node of a
+// query in query_nodes is released once shown
+void show_formulas(const mc_options& opts, const vector<ctl_formula*>& ctl_formulas,
+  const vector<int>& query_nodes, op_profile& profile) {
+  evaluate_ahead(opts, ctl_formulas);
+  for (size_t i = 0; i < ctl_formulas.size(); i++) {
+    if (opts.debug_level > 0 && ctl_formulas[i]->getType() != LABEL) {
+      profile.beginFormula(ctl_formulas[i]->text());
+    }
+    switch (ctl_formulas[i]->getType()) {
+      case MODEL:
+        static_cast<ctl_formula_models*>(ctl_formulas[i])->show();
+        break;
+      case LABEL:
+        static_cast<ctl_formula_labels*>(ctl_formulas[i])->show();
+        break;
+      case DISPLAY:
+        static_cast<ctl_formula_displays*>(ctl_formulas[i])->show();
+        break;
+      default:
+        exit(1);
+    }
+    if (query_nodes[i] >= 0) current->dag->release(query_nodes[i]);
+  }
+}
+
+
+// what a delta file (-u) changes in a model
+struct model_change {
+  vector< pair<state_id, state_id> > added, removed;
+  vector< pair<string, vector<state_id> > > labels;
+};
+
+/*
+  Parse a delta file, the bytes [begin, end):
+
+    ARCS
+      S0 -> S5;         an arc added
+      - S1 -> S2;       an arc removed
+    LABELS
+      p: S1, S3;        the states of label p from now on
+
+  Either section may be left out; the states of a label must be among
+  the num_states of the model. Returns false, after showing the syntax
+  error, if the file is not valid.
+*/
+bool parse_delta(const char* begin, const char* end, int num_states, model_change& c) {
+  fsm_state state = INIT;
+  bool removing = false;
+  state_id s1 = 0, s2 = 0;
+  string label;
+  int line_number = 0;
+  for (const char* next = begin; next < end; ) {
+    const char* eol = static_cast<const char*>(memchr(next, '\n', end - next));
+    if (0 == eol) eol = end;
+    line_view line(next, eol - next);
+    next = eol + 1;
+    line_number++;
+    for (int i = 0; i < line.size(); i++) {
+      if (line[i] == '#') break;
+      if (isspace(line[i])) continue;
+      const char* expecting = 0;
+      switch (state) {
+        case INIT:
+          if (read_string(line, i, "ARCS")) state = ARCS;
+          else if (read_string(line, i, "LABELS")) state = LABELS;
+          else expecting = "keyword ARCS or LABELS";
+          break;
+        case ARCS:
+          if (!removing && read_string(line, i, "LABELS")) state = LABELS;
+          else if (!removing && read_string(line, i, "-")) removing = true;
+          else if (read_state_id(line, i, s1)) state = ARCS_S1;
+          else expecting = removing ? "state (S*)" : "keyword LABELS, - or a state (S*)";
+          break;
+        case ARCS_S1:
+          if (read_string(line, i, "->")) state = ARCS_ARROW;
+          else expecting = "->";
+          break;
+        case ARCS_ARROW:
+          if (read_state_id(line, i, s2)) state = ARCS_S2;
+          else expecting = "state (S*)";
+          break;
+        case ARCS_S2:
+          if (!read_string(line, i, ";")) {
+            expecting = ";";
+            break;
+          }
+          (removing ? c.removed : c.added).push_back(make_pair(s1, s2));
+          removing = false;
+          state = ARCS;
+          break;
+        case LABELS:
+          if (read_label(line, i, label)) state = LABELS_L;
+          else expecting = "a label";
+          break;
+        case LABELS_L:
+          if (!read_string(line, i, ":")) {
+            expecting = ":";
+            break;
+          }
+          c.labels.push_back(make_pair(label, vector<state_id>()));
+          state = LABELS_COLON;
+          break;
+        case LABELS_COLON:
+        case LABELS_COMMA:
+          if (read_state_id(line, i, s1)) {
+            if (s1 >= num_states) {
+              expecting = "a valid state";
+              break;
+            }
+            c.labels.back().second.push_back(s1);
+            state = LABELS_S;
+          } else if (state == LABELS_COLON && read_string(line, i, ";")) {
+            state = LABELS;
+          } else expecting = (state == LABELS_COLON) ? "a state (S*) or ;" : "state (S*)";
+          break;
+        case LABELS_S:
+          if (read_string(line, i, ",")) state = LABELS_COMMA;
+          else if (read_string(line, i, ";")) state = LABELS;
+          else expecting = ", or ;";
+          break;
+        default:
+          exit(1);
+      }
+      if (expecting) {
+        syntax_error(cout, expecting, line_number, i, line);
+        return false;
+      }
+    }
+  }
+  if (state != INIT && state != ARCS && state != LABELS) {
+    cout << "Syntax error: unexpected end of file" << endl;
+    return false;
+  }
+  return true;
+}
+
+
+/*
+  Apply a delta file (-u) to a model whose formulas were evaluated:
+  change its arcs and the states of its labels, then bring the dag up
+  to date. Returns false, after showing why, if the file cannot be read
+  or applied; the model is then left as it was.
+*/
+bool apply_update(model* m, const char* path) {
+  input_buffer in;
+  if (!in.open(path)) {
+    cout << "An error has occurred whilst opening " << path << endl;
+    return false;
+  }
+  model_change c;
+  if (!parse_delta(in.begin(), in.end(), m->getNumStates(), c)) return false;
+  vector<int> ids;
+  for (size_t k = 0; k < c.labels.size(); k++) {
+    ids.push_back(current->symbols.find(c.labels[k].first));
+    if (ids.back() < 0 || 0 == current->symbols.getSet(ids.back())) {
+      cout << "Error: " << path << ": unknown label " << c.labels[k].first << endl;
+      return false;
+    }
+    if (current->symbols.getNode(ids.back()) >= 0) {
+      // its states follow from its formula
+      cout << "Error: " << path << ": " << c.labels[k].first << " is not a label of the LABELS section" << endl;
+      return false;
+    }
+  }
+  if ((!c.added.empty() || !c.removed.empty()) && !m->changeArcs(c.added, c.removed)) {
+    cout << "Error: " << path << ": cannot apply the changes of its ARCS section" << endl;
+    return false;
+  }
+
+  model_delta d;
+  d.arcs_added = !c.added.empty();
+  d.arcs_removed = !c.removed.empty();
+  state_set* sources = m->makeEmptySet();
+  for (size_t k = 0; k < c.added.size(); k++) m->addState(c.added[k].first, sources);
+  d.sources = sources;
+  for (size_t k = 0; k < c.labels.size(); k++) {
+    // the set of the label is changed in place: the dag refers to it
+    state_set* sset = current->symbols.getSet(ids[k]);
+    state_set* before = m->makeEmptySet();
+    state_set* after = m->makeEmptySet();
+    m->copy(sset, before);
+    for (size_t j = 0; j < c.labels[k].second.size(); j++) m->addState(c.labels[k].second[j], after);
+    m->copy(after, sset);
+    m->compact(sset);
+    m->deleteSet(after);
+    d.labels.push_back(make_pair(ids[k], before));
+  }
+  current->dag->update(d);
+
+  m->deleteSet(sources);
+  for (size_t k = 0; k < d.labels.size(); k++) m->deleteSet(const_cast<state_set*>(d.labels[k].second));
+  return true;
+}
+
+
+/*
+  The CTL section, one statement at a time: an assignment, S |= p or
+  [[ p ]]. step() reads the token at line[i], in the state the tokens
+  before it left; each statement completed is added to statements. On a
+  syntax error, step() returns false, with what it expected at column
+  error_col of the line.
+*/
+class ctl_reader {
+  model* m;
+  state_id s1;
+  string label;
+  vector<ctl_instr> formula;
+  ctl_formula* current_formula;
+  int declared;     // label the unfinished statement declared, or -1
+
+  bool fail(const char* what, int col) {
+    expecting = what;
+    error_col = col;
+    return false;
+  }
+
+  void done() {
+    state = CTL;
+    if (current_formula->getType() == LABEL) static_cast<ctl_formula_labels*>(current_formula)->assign();
+    statements.push_back(current_formula);
+    current_formula = 0;
+    declared = -1;
+  }
+
+  public:
+    fsm_state state;
+    vector<ctl_formula*> statements;
+    const char* expecting;
+    int error_col;
+
+    ctl_reader()
+    : m(0), current_formula(0), declared(-1), state(CTL), expecting(0), error_col(0) {}
+
+    // the statements are the caller's; an unfinished one is not
+    ~ctl_reader() { delete current_formula; }
+
+    void setModel(model* a_model) { m = a_model; }
+
+    // drop the statement a syntax error left unfinished, and the
+    // label it declared, if any: that label is still undeclared
+    void reset() {
+      delete current_formula;
+      current_formula = 0;
+      state = CTL;
+      if (declared >= 0) {
+        m->deleteSet(current->symbols.getSet(declared));
+        current->symbols.eraseSet(declared);
+        declared = -1;
+      }
+    }
+
+    bool step(const line_view& line, int& i) {
+      int root;
+      const char* why;
+      switch (state) {
+        case CTL:
+          // expecting state, label or '[[' 
+          formula.clear();
+
+          if (read_state_id(line, i, s1)) {
+            state = CTL_S;
+#ifdef DEBUG
+            cout << "  " << s1;
+#endif
+            if (!m->isValidState(s1)) return fail("a valid state", i);
+            ctl_formula_models* temp = new ctl_formula_models;
+            temp->setModel(m);
+            temp->setState(s1);
+            current_formula = temp;
+          } else if (read_label(line, i, label)) {
+            state = CTL_L;
+#ifdef DEBUG
+            cout << "  " << label;
+#endif
+            ctl_formula_labels* temp = new ctl_formula_labels;
+            temp->setModel(m);
+            int id = current->symbols.intern(label);
+            declared = current->symbols.getSet(id) ? -1 : id;
+            temp->setLabel(id);
+            current_formula = temp;
+          } else if (read_string(line, i, "[[")) {
+            state = CTL_SET_OPEN;
+#ifdef DEBUG
+            cout << "  [[";
+#endif
+            ctl_formula_displays* temp = new ctl_formula_displays;
+            temp->setModel(m);
+            current_formula = temp;
+          } else {
+            return fail("a state, a label, or [[", i);
+          }
+          break;
+
+        case CTL_S:
+          // expecting '|='
+          if (!read_string(line, i, "|=")) return fail("|=", i);
+          state = CTL_MODELS;
 #ifdef DEBUG
           cout << " !=";
 #endif
@@ -760,31 +1313,19 @@ model* parse_tokens(int debug_level, istream& source_stream) {
 
         case CTL_MODELS:
           // expecting label
-          if (!read_label(line, i, label)) {
-            syntax_error(cout, "a label", line_number, i, line);
-            exit(1);
-          }
-          current_state = CTL_S_L;
+          if (!read_label(line, i, label)) return fail("a label", i);
+          state = CTL_S_L;
 #ifdef DEBUG
           cout << " " << label;
 #endif
-          if (getSet(label) == 0) {
-            syntax_error(cout, "a previously declared label",
-                line_number, i+1-label.size(), line);
-            exit(1);
-          }
-          static_cast<ctl_formula_models*>(current_formula)->setLabel(label);
+          if (getSet(label) == 0) return fail("a previously declared label", i+1-label.size());
+          static_cast<ctl_formula_models*>(current_formula)->setLabel(current->symbols.find(label));
           break;
 
         case CTL_S_L:
           // expecting ';'
-          if (!read_string(line, i, ";")) {
-            syntax_error(cout, ";", line_number, i, line);
-            exit(1);
-          }
-          current_state = CTL;
-          ctl_formulas.push_back(current_formula);
-          current_formula = 0;
+          if (!read_string(line, i, ";")) return fail(";", i);
+          done();
 #ifdef DEBUG
           cout << ";" << endl;
 #endif
@@ -792,11 +1333,8 @@ model* parse_tokens(int debug_level, istream& source_stream) {
 
         case CTL_L:
           // expecting ':='
-          if (!read_string(line, i, ":=")) {
-            syntax_error(cout, ":=", line_number, i, line);
-            exit(1);
-          }
-          current_state = CTL_ASSIGN;
+          if (!read_string(line, i, ":=")) return fail(":=", i);
+          state = CTL_ASSIGN;
 #ifdef DEBUG
           cout << " :=";
 #endif
@@ -804,14 +1342,14 @@ model* parse_tokens(int debug_level, istream& source_stream) {
 
         case CTL_ASSIGN:
           // expecting formula
-          if (!read_formula(line, i, formula)) {
-            syntax_error(cout, "CTL formula", line_number, i, line);
+          why = "CTL formula";
+          if (!read_formula(line, i, formula, why)) {
 #ifdef DEBUG_FORMULA
             cout << endl;
-            for (int j = 0; j < formula.size(); j++) cout << " " << formula[j];
+            for (size_t j = 0; j < formula.size(); j++) cout << " " << instrName(formula[j]);
             cout << endl;
 #endif
-            exit(1);
+            return fail(why, i);
           }
 #ifdef DEBUG_FORMULA
           cout << "Finished reading formula from: " << line << endl;
@@ -819,22 +1357,19 @@ model* parse_tokens(int debug_level, istream& source_stream) {
           for (int j = 0; j < i; j++) cout << " ";
           cout << "^" << endl;
 #endif
-          current_state = CTL_FORMULA;
+          root = compile_formula(formula);
+          if (root < 0) return fail("CTL formula", i);
+          state = CTL_FORMULA;
 #ifdef DEBUG
-          for (int j = 0; j < formula.size(); j++) cout << " " << formula[j];
+          for (size_t j = 0; j < formula.size(); j++) cout << " " << instrName(formula[j]);
 #endif
-          static_cast<ctl_formula_labels*>(current_formula)->setFormula(formula);
+          static_cast<ctl_formula_labels*>(current_formula)->setFormula(formula, root);
           break;
 
         case CTL_FORMULA:
           // expecting ';'
-          if (!read_string(line, i, ";")) {
-            syntax_error(cout, ";", line_number, i, line);
-            exit(1);
-          }
-          current_state = CTL;
-          ctl_formulas.push_back(current_formula);
-          current_formula = 0;
+          if (!read_string(line, i, ";")) return fail(";", i);
+          done();
 #ifdef DEBUG
           cout << ";" << endl;
 #endif
@@ -842,29 +1377,19 @@ model* parse_tokens(int debug_level, istream& source_stream) {
 
         case CTL_SET_OPEN:
           // expecting label
-          if (!read_label(line, i, label)) {
-            syntax_error(cout, "a label", line_number, i, line);
-            exit(1);
-          }
-          current_state = CTL_SET_L;
+          if (!read_label(line, i, label)) return fail("a label", i);
+          state = CTL_SET_L;
 #ifdef DEBUG
           cout << " " << label;
 #endif
-          if (getSet(label) == 0) {
-            syntax_error(cout, "a previously declared label",
-                line_number, i+1-label.size(), line);
-            exit(1);
-          }
-          static_cast<ctl_formula_displays*>(current_formula)->setLabel(label);
+          if (getSet(label) == 0) return fail("a previously declared label", i+1-label.size());
+          static_cast<ctl_formula_displays*>(current_formula)->setLabel(current->symbols.find(label));
           break;
 
         case CTL_SET_L:
           // expecting ']]'
-          if (!read_string(line, i, "]]")) {
-            syntax_error(cout, "]]", line_number, i, line);
-            exit(1);
-          }
-          current_state = CTL_SET_CLOSE;
+          if (!read_string(line, i, "]]")) return fail("]]", i);
+          state = CTL_SET_CLOSE;
 #ifdef DEBUG
           cout << "]]";
 #endif
@@ -872,13 +1397,8 @@ model* parse_tokens(int debug_level, istream& source_stream) {
 
         case CTL_SET_CLOSE:
           // expecting ';'
-          if (!read_string(line, i, ";")) {
-            syntax_error(cout, ";", line_number, i, line);
-            exit(1);
-          }
-          current_state = CTL;
-          ctl_formulas.push_back(current_formula);
-          current_formula = 0;
+          if (!read_string(line, i, ";")) return fail(";", i);
+          done();
 #ifdef DEBUG
           cout << ";" << endl;
 #endif
@@ -887,115 +1407,621 @@ model* parse_tokens(int debug_level, istream& source_stream) {
         default:
           exit(1);
       }
+      return true;
+    }
+};
+
 
+// --serve: reply to one statement, with one line
+void answer(const mc_options& opts, ctl_formula* f, ostream& out, op_profile& profile) {
+  if (opts.debug_level > 0) profile.beginFormula(f->text());
+  ostream* saved = current->out;
+  current->out = &out;
+  switch (f->getType()) {
+    case MODEL:
+      static_cast<ctl_formula_models*>(f)->show();
+      break;
+    case LABEL:
+      // evaluated when a query needs it
+      out << "OK" << endl;
+      break;
+    case DISPLAY:
+      static_cast<ctl_formula_displays*>(f)->showStates();
+      break;
+    default:
+      exit(1);
+  }
+  current->out = saved;
+}
+
+
+// --serve: read one line of statements, and reply to each on out
+void serve_line(const mc_options& opts, ctl_reader& ctl, const line_view& line,
+  ostream& out, op_profile& profile) {
+  for (int i = 0; i < line.size(); i++) {
+    if (line[i] == '#') break;        // comment; ignore rest of line
+    if (isspace(line[i])) continue;   // whitespace; skip
+    if (!ctl.step(line, i)) {
+      out << "Syntax error: expecting " << ctl.expecting << " at col: " << ctl.error_col << endl;
+      ctl.reset();
+      break;
+    }
+    for (size_t k = 0; k < ctl.statements.size(); k++) {
+      answer(opts, ctl.statements[k], out, profile);
+      delete ctl.statements[k];
     }
+    ctl.statements.clear();
   }
+}
+
 
-  if (current_state == CTL) {
-    current_state = DONE;
-  } else {
+// --serve on a Unix domain socket: clients, one at a time, until killed
+void serve_socket(const mc_options& opts, ctl_reader& ctl, op_profile& profile) {
+  const char* path = opts.socket_path;
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    cout << "Error: socket path too long: " << path << endl;
+    exit(1);
+  }
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || bind(fd, (sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+    cout << "Error: cannot listen on " << path << ": " << strerror(errno) << endl;
+    exit(1);
+  }
+  cout << "Listening on " << path << endl;
+
+  vector<char> buf(1 << 16);
+  for (;;) {
+    int client = accept(fd, 0, 0);
+    if (client < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    // a request may end in the middle of a line: keep it for the next
+    string pending;
+    bool open = true;
+    while (open) {
+      ssize_t n = read(client, &buf[0], buf.size());
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        open = false;
+        pending += '\n';
+      } else {
+        pending.append(&buf[0], n);
+      }
+      ostringstream replies;
+      size_t start = 0;
+      for (size_t eol; (eol = pending.find('\n', start)) != string::npos; start = eol + 1) {
+        serve_line(opts, ctl, line_view(pending.data() + start, eol - start), replies, profile);
+      }
+      pending.erase(0, start);
+      string r = replies.str();
+      for (size_t sent = 0; sent < r.size(); ) {
+        ssize_t k = send(client, r.data() + sent, r.size() - sent, MSG_NOSIGNAL);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) {
+          open = false;
+          break;
+        }
+        sent += k;
+      }
+    }
+    ctl.reset();    // a statement the client left unfinished
+    close(client);
+  }
+  close(fd);
+}
+
+
+/*
+  --serve: once the input is done, keep the model, the labels and the
+  sets of the dag, and answer more statements of the CTL section,
+  read from standard input (until its end) or from clients of a Unix
+  domain socket. Each statement gets one line: the result of S |= p or
+  [[ p ]], OK for an assignment, or the syntax error, after which the
+  rest of the line is skipped. The sets of the dag are never freed, so
+  a subformula is only ever computed once.
+*/
+void serve(const mc_options& opts, ctl_reader& ctl, op_profile& profile) {
+  if (opts.socket_path) {
+    serve_socket(opts, ctl, profile);
+    return;
+  }
+  string line;
+  while (getline(cin, line)) {
+    serve_line(opts, ctl, line_view(line.data(), line.size()), cout, profile);
+    cout.flush();
+  }
+}
+
+
+/*
+  Parse the input source, the bytes [begin, end), into m and the
+  current parse_state; the statements of the CTL section are left in
+  ctl. If a model is given, it was loaded from a .ksb file: the source
+  then starts right after the labels, with more labels or the CTL
+  keyword. Otherwise m is set to a new model.
+  Once an error is written to err, returns KRIPKE_SYNTAX_ERROR, or
+  KRIPKE_BAD_MODEL if the arcs do not make a valid model; or returns
+  KRIPKE_NO_MODEL, with m 0, if the model could not be created.
+*/
+kripke_status parse_input(const mc_options& opts, model*& m, const char* begin, const char* end,
+  ctl_reader& ctl, ostream& err) {
+  bool loaded = (m != 0);
+  int num_states = 0;
+  fsm_state current_state = loaded ? LABELS : INIT;
+  int line_number = 0;
+
+  if (loaded) current->dag = new formula_dag(m);
+
+
+  const char* next = begin;
+  while (next < end) {
+    const char* eol = static_cast<const char*>(memchr(next, '\n', end - next));
+    if (0 == eol) eol = end;
+    line_view line(next, eol - next);
+    next = eol + 1;
+    line_number++;
+    for (int i=0; i<line.size(); i++) {
+      if (current_state == ARCS || current_state == LABELS) {
+        // parsed on their own, see parse_section();
+        // go on right after the keyword that ends the section
+        section_result r = parse_section(opts, m, current_state, line.data + i, line.data, end);
+        line_number += r.newlines;
+        const char* eol = static_cast<const char*>(memchr(r.line_start, '\n', end - r.line_start));
+        line = line_view(r.line_start, (eol ? eol : end) - r.line_start);
+        next = eol ? eol + 1 : end;
+        if (r.error) {
+          syntax_error(err, r.expecting, line_number, r.error - line.data, line);
+          return KRIPKE_SYNTAX_ERROR;
+        }
+        current_state = r.state;
+        if (0 == r.stop) break;   // end of file
+        if (current_state == CTL) {
 #ifdef DEBUG
-    cout << "Error: reached end of file in state #" << current_state << endl;
+          cout << "CTL" << endl;
 #endif
-    exit(1);
+          if (!loaded && !m->finish()) {
+            err << "Error: Kripke structure failed to finish\n";
+            return KRIPKE_BAD_MODEL;
+          }
+          for (int id = 0; id < current->symbols.size(); id++) {
+            if (current->symbols.getSet(id)) m->compact(current->symbols.getSet(id));
+          }
+          if (opts.export_file) export_ksb(opts.export_file, m);
+          ctl.setModel(m);
+        }
+        i = r.stop - line.data - 1;
+        continue;
+      }
+      if (line[i] == '#') break;        // comment; ignore rest of line
+      if (isspace(line[i])) continue;   // whitespace; skip
+
+      switch (current_state) {
+        case INIT:
+          // expecting "KRIPKE"
+          if (!read_string(line, i, "KRIPKE")) {
+            syntax_error(err, "keyword KRIPKE", line_number, i, line);
+            return KRIPKE_SYNTAX_ERROR;
+          }
+#ifdef DEBUG
+          cout << "KRIPKE" << endl;
+#endif
+          current_state = KRIPKE;
+          m = new_model(opts);
+          if (0==m) return KRIPKE_NO_MODEL;
+          m->setMessages(&err);
+          current->dag = new formula_dag(m);
+          break;
+
+        case KRIPKE:
+          // expecting "STATES"
+          if (!read_string(line, i, "STATES")) {
+            syntax_error(err, "keyword STATES", line_number, i, line);
+            return KRIPKE_SYNTAX_ERROR;
+          }
+#ifdef DEBUG
+          cout << "STATES";
+#endif
+          current_state = STATES;
+          break;
+
+        case STATES:
+          // expecting an integer
+          if (!read_integer(line, i, num_states)) {
+            syntax_error(err, "an integer", line_number, i, line);
+            return KRIPKE_SYNTAX_ERROR;
+          }
+#ifdef DEBUG
+          cout << " " << num_states;
+#endif
+          current_state = INTEGER;
+          m->setNumStates(num_states);
+          break;
+
+        case INTEGER:
+          // expecting ARCS
+          if (!read_string(line, i, "ARCS")) {
+            syntax_error(err, "keyword ARCS", line_number, i, line);
+            return KRIPKE_SYNTAX_ERROR;
+          }
+#ifdef DEBUG
+          cout << endl << "ARCS" << endl;
+#endif
+          current_state = ARCS;
+          break;
+
+        default:
+          if (!ctl.step(line, i)) {
+            syntax_error(err, ctl.expecting, line_number, ctl.error_col, line);
+            return KRIPKE_SYNTAX_ERROR;
+          }
+      }
+
+    }
+  }
+
+  if (current_state != CTL || ctl.state != CTL) {
+#ifdef DEBUG
+    err << "Error: reached end of file in state #" << current_state << endl;
+#endif
+    return KRIPKE_SYNTAX_ERROR;
   }
+  return KRIPKE_OK;
+}
 
 
-  // evaluate the CTL formulas
+/*
+  Evaluate the CTL section, once the input is parsed into m and the
+  current parse_state, and show its results; with -u, apply the updates
+  and show them again, and with --serve, go on with more statements.
+  With -d, the operations of each formula are recorded into profile.
+*/
+void check_formulas(const mc_options& opts, model* m, ctl_reader& ctl, op_profile& profile) {
+  vector<ctl_formula*>& ctl_formulas = ctl.statements;
+
+  if (opts.debug_level > 0) current->dag->setProfile(&profile);
+  new_local_checker(opts, m, profile);
 #if 1
-  for (int i = 0; i < ctl_formulas.size(); i++) {
-    if (ctl_formulas[i]->getType() == LABEL) {
-        static_cast<ctl_formula_labels*>(ctl_formulas[i])->getResult();
+  vector<int> query_nodes(ctl_formulas.size(), -1);
+  if (opts.evaluate_all) {
+    evaluate_ahead(opts, ctl_formulas);
+    for (size_t i = 0; i < ctl_formulas.size(); i++) {
+      if (ctl_formulas[i]->getType() == LABEL) {
+          if (opts.debug_level > 0) profile.beginFormula(ctl_formulas[i]->text());
+          static_cast<ctl_formula_labels*>(ctl_formulas[i])->getResult();
+      }
     }
-  }
-  for (int i = 0; i < ctl_formulas.size(); i++) {
-    switch (ctl_formulas[i]->getType()) {
-      case MODEL:
-        static_cast<ctl_formula_models*>(ctl_formulas[i])->show();
-        break;
-      case LABEL:
-        static_cast<ctl_formula_labels*>(ctl_formulas[i])->show();
-        break;
-      case DISPLAY:
-        static_cast<ctl_formula_displays*>(ctl_formulas[i])->show();
-        break;
-      default:
-        exit(1);
+  } else if (opts.updates.empty() && !opts.serve) {
+    // only what the queries read is evaluated, as they are shown; a
+    // set is freed as soon as no query still to be shown needs it
+    // (unless the model is to change, or to be queried again: updates
+    // start from the sets, and the server keeps them as a cache)
+    for (size_t i = 0; i < ctl_formulas.size(); i++) {
+      query_nodes[i] = ctl_formulas[i]->queryNode();
+      if (query_nodes[i] >= 0) current->dag->retain(query_nodes[i]);
     }
   }
+  show_formulas(opts, ctl_formulas, query_nodes, profile);
+
+  // with -u, the model is changed, and the results shown again
+  for (size_t u = 0; u < opts.updates.size(); u++) {
+    if (opts.debug_level > 0) profile.beginFormula(string("-u ") + opts.updates[u]);
+    if (!apply_update(m, opts.updates[u])) exit(1);
+    new_local_checker(opts, m, profile);
+    for (size_t i = 0; i < ctl_formulas.size(); i++) ctl_formulas[i]->forget();
+    *current->out << endl << "After " << opts.updates[u] << ":" << endl;
+    show_formulas(opts, ctl_formulas, query_nodes, profile);
+  }
 #endif
+  if (opts.serve) {
+    // the statements of the input are answered: the server only
+    // answers those it reads
+    for (size_t i = 0; i < ctl_formulas.size(); i++) delete ctl_formulas[i];
+    ctl_formulas.clear();
+    serve(opts, ctl, profile);
+  }
+}
 
+
+// free what a parse of m left in the current parse_state
+void release_parse_state(model* m) {
+  delete current->local;
+  current->local = 0;
+  delete current->dag;
+  current->dag = 0;
+  for (int id = 0; m && id < current->symbols.size(); id++) {
+    if (current->symbols.getSet(id)) m->deleteSet(current->symbols.getSet(id));
+  }
+  current->symbols.clear();
+}
+
+
+/*
+  Parse the input source, the bytes [begin, end), and show the results
+  of its CTL section; see parser.h.
+*/
+model* parse_tokens(const mc_options& opts, model* m, const char* begin, const char* end) {
+  ctl_reader ctl;
+  kripke_status status = parse_input(opts, m, begin, end, ctl, cout);
+  if (status == KRIPKE_NO_MODEL) {
+    cout << "Error, null model - did you rewrite function makeEmptyModel()?" << endl;
+  }
+  if (status != KRIPKE_OK) exit(1);
+  op_profile profile;
+  check_formulas(opts, m, ctl, profile);
+  if (opts.debug_level > 0) profile.write(cerr, opts.debug_level);
+  for (size_t i = 0; i < ctl.statements.size(); i++) delete ctl.statements[i];
+  release_parse_state(m);
   return m;
 }
 
-int usage(const char* who)
+
+// ---------------------------------------------------------------------
+// The library interface, kripke.h
+// ---------------------------------------------------------------------
+
+// the messages of the parser and of the model, without the blank lines around them
+string trimmed(const string& text) {
+  size_t b = text.find_first_not_of('\n');
+  if (b == string::npos) return "";
+  return text.substr(b, text.find_last_not_of('\n') + 1 - b);
+}
+
+kripke_context::kripke_context(int threads, bool sym)
+: num_threads(threads), symbolic(sym), m(0), state(new parse_state)
 {
-  cout << "\nUsage: " << who << " [-h] [-d debug_level] [input-file]\n\n";
-  cout << "\t-h: display this help screen\n\n";
-  cout << "\t-d: specify the debug level; a level of 0 (the default)\n";
-  cout << "\t    should not display any debugging information\n\n";
-  cout << "\tIf an input file is not specified, then the input file is\n";
-  cout << "\tread from standard input.\n\n";
-  return 1;
+  state->out = &log;
 }
 
-int main(int argc, const char *argv[])
+kripke_context::~kripke_context()
 {
-  const char* fn = 0;
-  model* m = 0;
-  int debuglevel = 0;
+  clear();
+  delete state;
+}
 
-  //
-  // Process arguments, if any
-  //
-  for (int i=1; i<argc; i++) {
+void kripke_context::clear()
+{
+  context_scope scope(state);
+  release_parse_state(m);
+  delete m;
+  m = 0;
+}
 
-    if (strcmp("-h", argv[i]) == 0) {
-      return usage(argv[0]);
-    }
+kripke_status kripke_context::fail(kripke_status status, const string& why)
+{
+  message = why;
+  return status;
+}
 
-    if (strcmp("-d", argv[i]) == 0) {
-      i++;
-      if (i>=argc) return usage(argv[0]);
-      debuglevel = atoi(argv[i]);
-      continue;
+kripke_status kripke_context::load(const char* begin, const char* end)
+{
+  clear();
+  context_scope scope(state);
+  mc_options opts;
+  opts.num_threads = num_threads;
+  opts.symbolic = symbolic;
+  ctl_reader ctl;
+  log.str("");
+  kripke_status status = parse_input(opts, m, begin, end, ctl, log);
+  // the queries are not answered; the assignments are in the dag
+  for (size_t k = 0; k < ctl.statements.size(); k++) delete ctl.statements[k];
+  ctl.reset();
+  if (status == KRIPKE_OK) return status;
+  string why = trimmed(log.str());
+  if (why.empty()) {
+    why = (status == KRIPKE_NO_MODEL) ? "Error: the model cannot be created"
+                                      : "Syntax error: unexpected end of input";
+  }
+  return fail(status, why);
+}
+
+kripke_status kripke_context::loadKSB(const void* data, size_t size)
+{
+  clear();
+  context_scope scope(state);
+  ksb_reader ksb;
+  string why;
+  if (!ksb.open(static_cast<const char*>(data), size, why)) return fail(KRIPKE_BAD_MODEL, "Error: " + why);
+  mc_options opts;
+  opts.num_threads = num_threads;
+  opts.symbolic = symbolic;
+  m = new_model(opts);
+  if (0==m) return fail(KRIPKE_NO_MODEL, "Error: the model cannot be created");
+  log.str("");
+  m->setMessages(&log);
+  current->dag = new formula_dag(m);
+  if (!read_ksb(m, ksb)) return fail(KRIPKE_BAD_MODEL, trimmed(log.str()));
+  return KRIPKE_OK;
+}
+
+kripke_status kripke_context::define(const char* label, const char* formula)
+{
+  if (0==m) return fail(KRIPKE_NO_MODEL, "Error: no model is loaded");
+  if (strchr(formula, ';')) return fail(KRIPKE_SYNTAX_ERROR, "Syntax error: ; in a formula");
+  context_scope scope(state);
+  // parsed as a statement of the CTL section
+  string text = string(label) + " := " + formula + ";";
+  line_view line(text.data(), text.size());
+  ctl_reader ctl;
+  ctl.setModel(m);
+  ostringstream why;
+  for (int i = 0; i < line.size(); i++) {
+    if (isspace(line[i])) continue;
+    if (!ctl.step(line, i)) {
+      syntax_error(why, ctl.expecting, 1, ctl.error_col, line);
+      break;
     }
+  }
+  bool assigned = why.str().empty() && ctl.state == CTL
+    && ctl.statements.size() == 1 && ctl.statements[0]->getType() == LABEL;
+  for (size_t k = 0; k < ctl.statements.size(); k++) delete ctl.statements[k];
+  ctl.reset();
+  if (assigned) return KRIPKE_OK;
+  if (why.str().empty()) why << "Syntax error: expecting label := formula in " << text;
+  return fail(KRIPKE_SYNTAX_ERROR, trimmed(why.str()));
+}
 
-    if (fn) return usage(argv[0]);
-    fn = argv[i];
+kripke_status kripke_context::lookup(const char* label, const state_set*& sset)
+{
+  if (0==m) return fail(KRIPKE_NO_MODEL, "Error: no model is loaded");
+  int id = current->symbols.find(label);
+  if (id < 0 || 0 == current->symbols.getSet(id)) {
+    return fail(KRIPKE_UNKNOWN_LABEL, string("Error: unknown label ") + label);
   }
-  
-  if (debuglevel) {
-    cout << "Using debug level " << debuglevel << endl;
+  sset = labelValue(id);
+  return KRIPKE_OK;
+}
+
+kripke_status kripke_context::evaluate(const char* label)
+{
+  context_scope scope(state);
+  const state_set* sset;
+  return lookup(label, sset);
+}
+
+kripke_status kripke_context::holds(state_id s, const char* label, bool& result)
+{
+  context_scope scope(state);
+  const state_set* sset;
+  kripke_status status = lookup(label, sset);
+  if (status != KRIPKE_OK) return status;
+  if (!m->isValidState(s)) return fail(KRIPKE_BAD_STATE, "Error: S" + to_string(s) + " is not a state");
+  result = m->elementOf(s, sset);
+  return KRIPKE_OK;
+}
+
+kripke_status kripke_context::states(const char* label, vector<state_id>& result)
+{
+  vector<uint64_t> words;
+  kripke_status status = bits(label, words);
+  if (status != KRIPKE_OK) return status;
+  result.clear();
+  for (size_t k = 0; k < words.size(); k++) {
+    for (uint64_t w = words[k]; w; w &= w - 1) result.push_back(k * 64 + __builtin_ctzll(w));
   }
+  return KRIPKE_OK;
+}
 
-  //
-  // Decide if input is file, or stdin
-  //
+kripke_status kripke_context::bits(const char* label, vector<uint64_t>& words)
+{
+  context_scope scope(state);
+  const state_set* sset;
+  kripke_status status = lookup(label, sset);
+  if (status != KRIPKE_OK) return status;
+  m->getWords(sset, words);
+  return KRIPKE_OK;
+}
 
-  if (fn) {
-    //
-    // Filename specified
-    //
-    fstream source(fn);
-    if ( source.fail() ) {
-      cout << "An error has occurred whilst opening "<< fn << endl;
-      exit(0);
-    }
-    m = parse_tokens(debuglevel, source);
+int kripke_context::numStates() const
+{
+  return m ? m->getNumStates() : 0;
+}
 
-  } else {
-    //
-    // Read from standard input
-    //
 
-    m = parse_tokens(debuglevel, cin);
+// ---------------------------------------------------------------------
+// --batch: several inputs, each with its own model and labels
+// ---------------------------------------------------------------------
+
+/*
+  Check one input file, as mctool would with opts, in a parse_state of
+  its own: the results and the errors go to out, and with -d, the
+  profile to log. False if the file cannot be read or does not parse.
+*/
+bool check_file(const mc_options& opts, const char* path, ostream& out, ostream& log) {
+  parse_state state;
+  state.out = &out;
+  context_scope scope(&state);
+
+  input_buffer source;
+  if (!source.open(path)) {
+    out << "An error has occurred whilst opening " << path << endl;
+    return false;
+  }
+  if (isKSB(source.begin(), source.size())) {
+    out << "Error: " << path << ": a .ksb file needs a ctl-file, which --batch cannot give" << endl;
+    return false;
   }
 
-  if (m) {
-    delete m;
-  } else {
-    cout << "Error, null model - did you rewrite function makeEmptyModel()?" << endl;
+  model* m = 0;
+  ctl_reader ctl;
+  bool ok = (parse_input(opts, m, source.begin(), source.end(), ctl, out) == KRIPKE_OK);
+  if (ok) {
+    op_profile profile;
+    check_formulas(opts, m, ctl, profile);
+    if (opts.debug_level > 0) profile.write(log, opts.debug_level);
+  } else if (0 == m) {
+    out << "Error, null model - did you rewrite function makeEmptyModel()?" << endl;
   }
+  ctl.reset();    // a statement a syntax error left unfinished
+  for (size_t i = 0; i < ctl.statements.size(); i++) delete ctl.statements[i];
+  release_parse_state(m);
+  delete m;
+  return ok;
 }
 
+// the output file of an input with --outdir: dir/name.out
+string output_path(const char* out_dir, const char* path) {
+  const char* name = strrchr(path, '/');
+  return string(out_dir) + "/" + (name ? name + 1 : path) + ".out";
+}
+
+/*
+  Check several input files; see parser.h. Each file is one task of a
+  thread pool, and its output is kept in memory until all the files
+  before it are written, so that the output is in the order of the
+  files, whichever finishes first.
+*/
+int check_files(const mc_options& opts, const vector<const char*>& files, const char* out_dir) {
+  mc_options file_opts = opts;
+  file_opts.num_threads = 1;      // the threads go to the files
+
+  int n = files.size();
+  vector<string> outputs(n), logs(n);
+  vector<bool> done(n, false);
+  vector<bool> failed(n, false);
+  int next = 0;                   // the first file not yet written
+  mutex lock;
+
+  thread_pool pool(opts.num_threads);
+  pool.parallel_for(0, n, 1, [&](int lo, int hi) {
+    for (int f = lo; f < hi; f++) {
+      ostringstream out, log;
+      bool ok = check_file(file_opts, files[f], out, log);
+      if (out_dir) {
+        // only an error in writing the file is left for standard output
+        string out_path = output_path(out_dir, files[f]);
+        ofstream file(out_path.c_str());
+        file << out.str();
+        out.str("");
+        if (!file) {
+          out << "Error: cannot write " << out_path << endl;
+          ok = false;
+        }
+      }
+
+      lock_guard<mutex> guard(lock);
+      outputs[f] = out.str();
+      logs[f] = log.str();
+      failed[f] = !ok;
+      done[f] = true;
+      // write every file that is ready, in order
+      for (; next < n && done[next]; next++) {
+        if (!out_dir) cout << files[next] << ":" << endl;
+        cout << outputs[next];
+        cout.flush();
+        cerr << logs[next];
+        string().swap(outputs[next]);
+        string().swap(logs[next]);
+      }
+    }
+  });
+
+  int failures = 0;
+  for (int f = 0; f < n; f++) if (failed[f]) failures++;
+  return failures;
+}
@@ -0,0 +1,55 @@
+#ifndef __PARSER_H__
+#define __PARSER_H__
+
+#include <vector>
+
+#include "model.h"
+
+class ksb_reader;
+
+// command line options that affect parsing and model checking
+struct mc_options {
+  int debug_level;
+  int num_threads;
+  bool symbolic;      // use the BDD model instead of the explicit one
+  const char* export_file;    // .ksb file to save the model to, or 0
+  bool evaluate_all;  // evaluate every assignment, not only what the queries need
+  bool local;         // answer S |= p by a search from S (explicit model only)
+  std::vector<const char*> updates;   // delta files to apply after the results (-u)
+  bool serve;         // then answer more statements, from stdin or socket_path
+  const char* socket_path;    // Unix domain socket to serve on, or 0 for stdin
+  mc_options() : debug_level(0), num_threads(1), symbolic(false), export_file(0),
+    evaluate_all(false), local(false), serve(false), socket_path(0) {}
+};
+
+/**
+    Parse an input, the bytes [begin, end), and show the results of its
+    CTL section on standard output. Exits, with status 1, on a syntax
+    error or if the model cannot be created. With opts.serve, goes on
+    answering statements until the end of standard input, or forever
+    on opts.socket_path.
+
+      @param  m   0 to parse a whole input; or a model loaded from a
+                  .ksb file, and then the input starts right after the
+                  labels (with more labels, or the CTL keyword).
+      @return     The model, to be deleted by the caller.
+*/
+model* parse_tokens(const mc_options& opts, model* m, const char* begin, const char* end);
+
+/**
+    --batch: check several input files, each with a model and labels of
+    its own, as parse_tokens() would one by one, opts.num_threads files
+    at a time (the labeling operations of each are single threaded).
+    The results go to standard output in the order of the files, each
+    under a "file:" line; or, with out_dir, to out_dir/name.out for an
+    input named name. A file that does not parse, or cannot be read,
+    has the error in its output instead, and the others go on.
+
+      @return     The number of files that failed.
+*/
+int check_files(const mc_options& opts, const std::vector<const char*>& files, const char* out_dir);
+
+/// Build a model, and its labels, from a .ksb file.
+model* load_ksb(const mc_options& opts, const ksb_reader& ksb);
+
+#endif
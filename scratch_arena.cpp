@@ -0,0 +1,50 @@
+
+#include "scratch_arena.h"
+
+#include <algorithm>
+
+static const size_t MIN_BLOCK = 1 << 16;
+
+scratch_arena::scratch_arena()
+: current(0), used(0)
+{
+}
+
+scratch_arena::~scratch_arena()
+{
+  for (size_t i = 0; i < blocks.size(); i++) delete[] blocks[i].data;
+}
+
+size_t scratch_arena::capacity() const
+{
+  size_t c = 0;
+  for (size_t i = 0; i < blocks.size(); i++) c += blocks[i].size;
+  return c;
+}
+
+void* scratch_arena::allocBytes(size_t n)
+{
+  n = (n + 7) & ~size_t(7);
+  if (current < blocks.size() && used + n <= blocks[current].size) {
+    void* p = blocks[current].data + used;
+    used += n;
+    return p;
+  }
+
+  // on to the next block; one that is too small is replaced, by a
+  // block at least twice as large as the last one
+  size_t next = blocks.empty() ? 0 : current + 1;
+  if (next == blocks.size() || blocks[next].size < n) {
+    size_t size = std::max(std::max(n, MIN_BLOCK), blocks.empty() ? 0 : 2 * blocks.back().size);
+    block b = { new char[size], size };
+    if (next == blocks.size()) {
+      blocks.push_back(b);
+    } else {
+      delete[] blocks[next].data;
+      blocks[next] = b;
+    }
+  }
+  current = next;
+  used = n;
+  return blocks[current].data;
+}
@@ -0,0 +1,61 @@
+#ifndef __SCRATCH_ARENA_H__
+#define __SCRATCH_ARENA_H__
+
+#include <cstddef>
+#include <vector>
+
+/**
+  Scratch memory for the temporaries of the labeling operations.
+
+  Memory is cut from large blocks by moving a pointer, and given back
+  in stack order: release(m) frees everything allocated since
+  m = mark(), so an operation that calls another one (EF calls EU)
+  simply nests. Blocks are kept once allocated; after the largest
+  operation has run, no more memory is taken from the heap.
+
+  One thread allocates; the memory itself may be used by any thread.
+*/
+class scratch_arena {
+  public:
+    struct mark_t {
+      size_t block;     // index of the block being filled
+      size_t used;      // bytes used in it
+    };
+
+    scratch_arena();
+    ~scratch_arena();
+
+    /// Room for n objects of type T, not initialized, aligned to 8 bytes.
+    template <class T>
+    T* alloc(size_t n) {
+      return static_cast<T*>(allocBytes(n * sizeof(T)));
+    }
+
+    mark_t mark() const {
+      mark_t m = { current, used };
+      return m;
+    }
+
+    /// Free everything allocated since m was taken.
+    void release(const mark_t& m) {
+      current = m.block;
+      used = m.used;
+    }
+
+    /// Bytes taken from the heap.
+    size_t capacity() const;
+
+  private:
+    struct block {
+      char* data;
+      size_t size;
+    };
+
+    void* allocBytes(size_t n);
+
+    std::vector<block> blocks;
+    size_t current;
+    size_t used;
+};
+
+#endif
@@ -0,0 +1,430 @@
+#include "model.h"
+
+#include <algorithm>
+#include <cstring>
+
+typedef state_set::word word;
+
+const int state_set::WORD_BITS;
+const int state_set::CHUNK_STATES;
+const int state_set::CHUNK_WORDS;
+
+// Above this many states, an array container takes more room than a bitmap.
+static const int ARRAY_MAX = 4096;
+static const int CHUNK_MASK = state_set::CHUNK_STATES - 1;
+
+// Words of chunk key that lie in a bitset of num_words words.
+static int wordsInChunk(int num_words, int key)
+{
+  return std::min(state_set::CHUNK_WORDS, num_words - key * state_set::CHUNK_WORDS);
+}
+
+// Set bits lo..hi (inclusive) of a bitset.
+static void setRange(word* bits, int lo, int hi)
+{
+  int wl = lo / state_set::WORD_BITS, wh = hi / state_set::WORD_BITS;
+  word first = ~word(0) << (lo % state_set::WORD_BITS);
+  word last = ~word(0) >> (state_set::WORD_BITS - 1 - hi % state_set::WORD_BITS);
+  if (wl == wh) {
+    bits[wl] |= first & last;
+    return;
+  }
+  bits[wl] |= first;
+  for (int w = wl + 1; w < wh; w++) bits[w] = ~word(0);
+  bits[wh] |= last;
+}
+
+// First bit >= pos of a chunk bitmap equal to value, or CHUNK_STATES.
+static int nextBit(const word* bits, int pos, bool value)
+{
+  if (pos >= state_set::CHUNK_STATES) return state_set::CHUNK_STATES;
+  int w = pos / state_set::WORD_BITS;
+  word b = (value ? bits[w] : ~bits[w]) & (~word(0) << (pos % state_set::WORD_BITS));
+  for (;;) {
+    if (b) return w * state_set::WORD_BITS + __builtin_ctzll(b);
+    if (++w == state_set::CHUNK_WORDS) return state_set::CHUNK_STATES;
+    b = value ? bits[w] : ~bits[w];
+  }
+}
+
+//
+// Containers
+//
+
+bool state_set::has(const container& c, int low)
+{
+  switch (c.kind) {
+    case container::ARRAY:
+      return std::binary_search(c.vals.begin(), c.vals.end(), uint16_t(low));
+    case container::BITMAP:
+      return (c.bits[low / WORD_BITS] >> (low % WORD_BITS)) & 1;
+    default: {
+      // last run starting at or before low
+      int lo = 0, hi = c.vals.size() / 2;
+      while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (c.vals[2*mid] <= low) lo = mid + 1; else hi = mid;
+      }
+      return lo > 0 && low <= c.vals[2*lo - 1];
+    }
+  }
+}
+
+int state_set::nextIn(const container& c, int low)
+{
+  switch (c.kind) {
+    case container::ARRAY: {
+      std::vector<uint16_t>::const_iterator i = std::lower_bound(c.vals.begin(), c.vals.end(), uint16_t(low));
+      return i == c.vals.end() ? -1 : *i;
+    }
+    case container::BITMAP: {
+      int b = nextBit(&c.bits[0], low, true);
+      return b == CHUNK_STATES ? -1 : b;
+    }
+    default:
+      for (size_t r = 0; r < c.vals.size(); r += 2) {
+        if (c.vals[r+1] >= low) return std::max(int(c.vals[r]), low);
+      }
+      return -1;
+  }
+}
+
+// Write the states of c as a bitset of nwords words.
+void state_set::expand(const container& c, word* bits, int nwords)
+{
+  if (c.kind == container::BITMAP) {
+    memcpy(bits, &c.bits[0], nwords * sizeof(word));
+    return;
+  }
+  memset(bits, 0, nwords * sizeof(word));
+  if (c.kind == container::ARRAY) {
+    for (size_t i = 0; i < c.vals.size(); i++) {
+      bits[c.vals[i] / WORD_BITS] |= word(1) << (c.vals[i] % WORD_BITS);
+    }
+  } else {
+    for (size_t r = 0; r < c.vals.size(); r += 2) setRange(bits, c.vals[r], c.vals[r+1]);
+  }
+}
+
+// Store the states of a chunk bitmap in c, in the smallest of the three containers.
+void state_set::encode(const word* bits, container& c)
+{
+  int card = 0, runs = 0;
+  word carry = 0;
+  for (int w = 0; w < CHUNK_WORDS; w++) {
+    card += __builtin_popcountll(bits[w]);
+    runs += __builtin_popcountll(bits[w] & ~((bits[w] << 1) | carry));
+    carry = bits[w] >> (WORD_BITS - 1);
+  }
+  c.card = card;
+
+  std::vector<uint16_t> vals;
+  std::vector<word> map;
+  size_t array_bytes = 2 * size_t(card), run_bytes = 4 * size_t(runs);
+  size_t bitmap_bytes = CHUNK_WORDS * sizeof(word);
+  if (run_bytes < array_bytes && run_bytes < bitmap_bytes) {
+    c.kind = container::RUNS;
+    vals.reserve(2 * runs);
+    for (int b = nextBit(bits, 0, true); b < CHUNK_STATES; ) {
+      int e = nextBit(bits, b, false);
+      vals.push_back(b);
+      vals.push_back(e - 1);
+      b = nextBit(bits, e, true);
+    }
+  } else if (array_bytes <= bitmap_bytes) {
+    c.kind = container::ARRAY;
+    vals.reserve(card);
+    for (int w = 0; w < CHUNK_WORDS; w++) {
+      for (word b = bits[w]; b; b &= b - 1) vals.push_back(w * WORD_BITS + __builtin_ctzll(b));
+    }
+  } else {
+    c.kind = container::BITMAP;
+    map.assign(bits, bits + CHUNK_WORDS);
+  }
+  c.vals.swap(vals);
+  c.bits.swap(map);
+}
+
+void state_set::toBitmap(container& c)
+{
+  std::vector<word> map(CHUNK_WORDS);
+  expand(c, &map[0], CHUNK_WORDS);
+  c.bits.swap(map);
+  std::vector<uint16_t>().swap(c.vals);
+  c.kind = container::BITMAP;
+}
+
+//
+// Chunked form
+//
+
+// Index of the first chunk with a key >= key.
+size_t state_set::lowerChunk(int key) const
+{
+  size_t lo = 0, hi = chunks.size();
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (chunks[mid].key < key) lo = mid + 1; else hi = mid;
+  }
+  return lo;
+}
+
+bool state_set::chunkContains(state_id s) const
+{
+  size_t i = lowerChunk(s / CHUNK_STATES);
+  return i < chunks.size() && chunks[i].key == s / CHUNK_STATES && has(chunks[i], s & CHUNK_MASK);
+}
+
+void state_set::chunkInsert(state_id s)
+{
+  int key = s / CHUNK_STATES, low = s & CHUNK_MASK;
+  size_t i = lowerChunk(key);
+  if (i == chunks.size() || chunks[i].key != key) {
+    container c;
+    c.key = key;
+    c.kind = container::ARRAY;
+    c.card = 0;
+    chunks.insert(chunks.begin() + i, c);
+  }
+  container& c = chunks[i];
+  if (has(c, low)) return;
+  if (c.kind == container::RUNS || (c.kind == container::ARRAY && c.card == ARRAY_MAX)) toBitmap(c);
+  if (c.kind == container::ARRAY) {
+    c.vals.insert(std::upper_bound(c.vals.begin(), c.vals.end(), uint16_t(low)), uint16_t(low));
+  } else {
+    c.bits[low / WORD_BITS] |= word(1) << (low % WORD_BITS);
+  }
+  c.card++;
+}
+
+void state_set::chunkErase(state_id s)
+{
+  int key = s / CHUNK_STATES, low = s & CHUNK_MASK;
+  size_t i = lowerChunk(key);
+  if (i == chunks.size() || chunks[i].key != key || !has(chunks[i], low)) return;
+  container& c = chunks[i];
+  if (--c.card == 0) {
+    chunks.erase(chunks.begin() + i);
+    return;
+  }
+  if (c.kind == container::RUNS) toBitmap(c);
+  if (c.kind == container::ARRAY) {
+    c.vals.erase(std::lower_bound(c.vals.begin(), c.vals.end(), uint16_t(low)));
+  } else {
+    c.bits[low / WORD_BITS] &= ~(word(1) << (low % WORD_BITS));
+  }
+}
+
+// The words of chunk key: a slice of the bitset of a dense set, the
+// bitmap of a container, or its expansion into buf; 0 for an empty chunk.
+const word* state_set::chunkWords(int key, word* buf) const
+{
+  if (dense) return &words[size_t(key) * CHUNK_WORDS];
+  size_t i = lowerChunk(key);
+  if (i == chunks.size() || chunks[i].key != key) return 0;
+  if (chunks[i].kind == container::BITMAP) return &chunks[i].bits[0];
+  expand(chunks[i], buf, CHUNK_WORDS);
+  return buf;
+}
+
+//
+// Both forms
+//
+
+void state_set::resize(int n)
+{
+  num_states = n;
+  dense = false;
+  words.clear();      // keeps the capacity, for a recycled set made dense again
+  chunks.clear();
+}
+
+void state_set::makeDense()
+{
+  if (dense) return;
+  words.assign(numWords(), 0);
+  for (size_t i = 0; i < chunks.size(); i++) {
+    int key = chunks[i].key;
+    expand(chunks[i], &words[size_t(key) * CHUNK_WORDS], wordsInChunk(numWords(), key));
+  }
+  chunks.clear();
+  dense = true;
+}
+
+void state_set::optimize()
+{
+  std::vector<container> packed;
+  std::vector<word> buf(CHUNK_WORDS);
+  int num_chunks = (num_states + CHUNK_STATES - 1) / CHUNK_STATES;
+  for (int key = 0; key < num_chunks; key++) {
+    const word* bits = chunkWords(key, &buf[0]);
+    if (!bits) continue;
+    int nw = wordsInChunk(numWords(), key);
+    if (bits != &buf[0]) {
+      std::copy(bits, bits + nw, buf.begin());
+      std::fill(buf.begin() + nw, buf.end(), 0);
+    }
+    container c;
+    c.key = key;
+    encode(&buf[0], c);
+    if (c.card) packed.push_back(c);
+  }
+  chunks.swap(packed);
+  std::vector<word>().swap(words);
+  dense = false;
+}
+
+void state_set::toWords(word* out) const
+{
+  if (dense) {
+    std::copy(words.begin(), words.end(), out);
+    return;
+  }
+  memset(out, 0, numWords() * sizeof(word));
+  for (size_t i = 0; i < chunks.size(); i++) {
+    int key = chunks[i].key;
+    expand(chunks[i], out + size_t(key) * CHUNK_WORDS, wordsInChunk(numWords(), key));
+  }
+}
+
+void state_set::clear()
+{
+  if (dense) std::fill(words.begin(), words.end(), 0);
+  else chunks.clear();
+}
+
+void state_set::fill()
+{
+  if (dense) {
+    std::fill(words.begin(), words.end(), ~word(0));
+    if (numWords()) words[numWords()-1] &= tailMask();
+    return;
+  }
+  chunks.clear();
+  for (int first = 0; first < num_states; first += CHUNK_STATES) {
+    container c;
+    c.key = first / CHUNK_STATES;
+    c.kind = container::RUNS;
+    c.card = std::min(CHUNK_STATES, num_states - first);
+    c.vals.push_back(0);
+    c.vals.push_back(c.card - 1);
+    chunks.push_back(c);
+  }
+}
+
+int state_set::count() const
+{
+  int c = 0;
+  if (dense) {
+    for (int w = 0; w < numWords(); w++) c += __builtin_popcountll(words[w]);
+  } else {
+    for (size_t i = 0; i < chunks.size(); i++) c += chunks[i].card;
+  }
+  return c;
+}
+
+state_id state_set::next(state_id s) const
+{
+  if (s >= num_states) return -1;
+  if (dense) {
+    int w = s / WORD_BITS;
+    word bits = words[w] & (~word(0) << (s % WORD_BITS));
+    for (;;) {
+      if (bits) return w * WORD_BITS + __builtin_ctzll(bits);
+      if (++w >= numWords()) return -1;
+      bits = words[w];
+    }
+  }
+  int key = s / CHUNK_STATES;
+  for (size_t i = lowerChunk(key); i < chunks.size(); i++) {
+    int low = nextIn(chunks[i], chunks[i].key == key ? s & CHUNK_MASK : 0);
+    if (low >= 0) return chunks[i].key * CHUNK_STATES + low;
+  }
+  return -1;
+}
+
+bool state_set::operator==(const state_set& other) const
+{
+  if (num_states != other.num_states) return false;
+  if (dense && other.dense) return words == other.words;
+  if (count() != other.count()) return false;
+
+  std::vector<word> buf(2 * CHUNK_WORDS);
+  int num_chunks = (num_states + CHUNK_STATES - 1) / CHUNK_STATES;
+  for (int key = 0; key < num_chunks; key++) {
+    const word* a = chunkWords(key, &buf[0]);
+    const word* b = other.chunkWords(key, &buf[CHUNK_WORDS]);
+    int nw = wordsInChunk(numWords(), key);
+    for (int w = 0; w < nw; w++) {
+      if ((a ? a[w] : 0) != (b ? b[w] : 0)) return false;
+    }
+  }
+  return true;
+}
+
+bool state_set::subsetOf(const state_set& other) const
+{
+  std::vector<word> buf(2 * CHUNK_WORDS);
+  int num_chunks = (num_states + CHUNK_STATES - 1) / CHUNK_STATES;
+  for (int key = 0; key < num_chunks; key++) {
+    const word* a = chunkWords(key, &buf[0]);
+    if (!a) continue;
+    const word* b = other.chunkWords(key, &buf[CHUNK_WORDS]);
+    int nw = wordsInChunk(numWords(), key);
+    for (int w = 0; w < nw; w++) {
+      if (a[w] & ~(b ? b[w] : 0)) return false;
+    }
+  }
+  return true;
+}
+
+//
+// Boolean operations
+//
+
+void state_set::assignAnd(const state_set& a, const state_set& b) { combine(OP_AND, a, &b); }
+void state_set::assignOr(const state_set& a, const state_set& b) { combine(OP_OR, a, &b); }
+void state_set::assignNot(const state_set& a) { combine(OP_NOT, a, 0); }
+void state_set::assignImplies(const state_set& a, const state_set& b) { combine(OP_IMPLIES, a, &b); }
+
+void state_set::combine(bool_op op, const state_set& a, const state_set* b)
+{
+  // built apart and swapped in, since a or b may be this set
+  state_set r(num_states);
+  std::vector<word> buf(3 * CHUNK_WORDS);
+  word* abuf = &buf[0];
+  word* bbuf = &buf[CHUNK_WORDS];
+  word* out = &buf[2 * CHUNK_WORDS];
+  int num_chunks = (num_states + CHUNK_STATES - 1) / CHUNK_STATES;
+
+  for (int key = 0; key < num_chunks; key++) {
+    int nw = wordsInChunk(numWords(), key);
+    const word* x = a.chunkWords(key, abuf);
+    const word* y = b ? b->chunkWords(key, bbuf) : 0;
+    switch (op) {
+      case OP_AND:
+        if (!x || !y) continue;
+        for (int w = 0; w < nw; w++) out[w] = x[w] & y[w];
+        break;
+      case OP_OR:
+        if (!x && !y) continue;
+        for (int w = 0; w < nw; w++) out[w] = (x ? x[w] : 0) | (y ? y[w] : 0);
+        break;
+      case OP_NOT:
+        for (int w = 0; w < nw; w++) out[w] = x ? ~x[w] : ~word(0);
+        break;
+      case OP_IMPLIES:
+        for (int w = 0; w < nw; w++) out[w] = (x ? ~x[w] : ~word(0)) | (y ? y[w] : 0);
+        break;
+    }
+    // the bits past the last state, and past the words of the last chunk
+    if (key == num_chunks - 1) out[nw-1] &= tailMask();
+    std::fill(out + nw, out + CHUNK_WORDS, 0);
+
+    container c;
+    c.key = key;
+    encode(out, c);
+    if (c.card) r.chunks.push_back(c);
+  }
+  swap(r);
+}
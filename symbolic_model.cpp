@@ -0,0 +1,506 @@
+
+#include "model.h"
+#include "bdd.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+/*
+  Symbolic model: states are encoded in binary, and both the
+  transition relation and every state_set are BDDs.
+
+  With k bits per state, bit i (most significant first) of the
+  current state is variable 2i and bit i of the next state is
+  variable 2i+1. Interleaving keeps the transition relation small for
+  regular models, and makes renaming current to next variables an
+  order-preserving shift by one.
+
+  Every set only ever contains valid states (0..n-1), so complements
+  are taken relative to the set of valid states.
+*/
+
+typedef std::pair<state_id, state_id> pairs;
+
+/*
+  A state_set of the symbolic model. The bitset part of the base class
+  stays empty; the states are the satisfying assignments of root.
+*/
+class bdd_set : public state_set
+{
+	public:
+		bdd root;
+		bdd_set() : root(BDD_FALSE) { }
+};
+
+class model_symbolic : public model
+{
+	private:
+		int num_srcs;
+		int num_bits;                    // k
+		bdd_manager* mgr;
+		std::vector< pairs > arc_buf;    // arcs as added, consumed by finish()
+		bdd trans;                       // T(x, y)
+		bdd valid;                       // states 0..n-1, over x
+		int next_vars;                   // variable set of y
+		int to_next;                     // renaming x -> y
+		std::set<bdd_set*> live;         // sets not yet deleted, roots for gc
+		op_counters* counters;           // null unless the work is counted
+
+		static bdd_set* bset(state_set* s) { return static_cast<bdd_set*>(s); }
+		static bdd root(const state_set* s) { return static_cast<const bdd_set*>(s)->root; }
+
+		int curVar(int i) const { return 2*i; }
+		int nextVar(int i) const { return 2*i+1; }
+		int bitOf(state_id s, int i) const { return (s >> (num_bits-1-i)) & 1; }
+
+		// The single state s, over x.
+		bdd minterm(state_id s)
+		{
+			bdd r = BDD_TRUE;
+			for(int i = num_bits-1; i >= 0; i--)
+				r = bitOf(s, i) ? mgr->makeNode(curVar(i), BDD_FALSE, r)
+				                : mgr->makeNode(curVar(i), r, BDD_FALSE);
+			return r;
+		}
+
+		// States s <= m, over bits i.. of x.
+		bdd atMost(state_id m, int i)
+		{
+			if(i == num_bits)
+				return BDD_TRUE;
+			bdd rest = atMost(m, i+1);
+			return bitOf(m, i) ? mgr->makeNode(curVar(i), BDD_TRUE, rest)
+			                   : mgr->makeNode(curVar(i), rest, BDD_FALSE);
+		}
+
+		/*
+		  The relation holding exactly the arcs keys[lo..hi), where a key
+		  is an arc with the bits of source and destination interleaved in
+		  variable order, from level l on. keys must be sorted, so the arcs
+		  whose bit at level l is 0 come first.
+		*/
+		bdd buildRelation(const std::vector<uint64_t>& keys, int lo, int hi, int l)
+		{
+			if(lo == hi)
+				return BDD_FALSE;
+			if(l == 2*num_bits)
+				return BDD_TRUE;
+			// all keys of the range agree above level l, so the first one
+			// with bit l set is found by binary search
+			uint64_t bit = uint64_t(1) << (2*num_bits-1-l);
+			uint64_t first_one = (keys[lo] & ~(2*bit-1)) | bit;
+			int mid = std::lower_bound(keys.begin()+lo, keys.begin()+hi, first_one) - keys.begin();
+			bdd r0 = buildRelation(keys, lo, mid, l+1);
+			bdd r1 = buildRelation(keys, mid, hi, l+1);
+			return mgr->makeNode(l, r0, r1);
+		}
+
+		// The relation holding exactly the given arcs, all between valid states.
+		bdd relation(const std::vector<pairs>& arcs)
+		{
+			std::vector<uint64_t> keys(arcs.size());
+			for(size_t k = 0; k < arcs.size(); k++)
+			{
+				uint64_t key = 0;
+				for(int i = 0; i < num_bits; i++)
+					key = (key << 2) | (bitOf(arcs[k].first, i) << 1) | bitOf(arcs[k].second, i);
+				keys[k] = key;
+			}
+			std::sort(keys.begin(), keys.end());
+			keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+			return buildRelation(keys, 0, keys.size(), 0);
+		}
+
+		// The smallest state of a set p over x, which is not empty.
+		state_id firstState(bdd p)
+		{
+			state_id s = 0;
+			for(int i = 0; i < num_bits; i++)
+			{
+				s <<= 1;
+				if(p == BDD_TRUE || mgr->var(p) != curVar(i)) // bit i is free: 0
+					continue;
+				if(mgr->low(p) != BDD_FALSE)
+					p = mgr->low(p);
+				else
+				{
+					s |= 1;
+					p = mgr->high(p);
+				}
+			}
+			return s;
+		}
+
+		// Collect garbage if needed; a..d are the operation's own live bdds.
+		void checkpoint(bdd a = BDD_FALSE, bdd b = BDD_FALSE, bdd c = BDD_FALSE, bdd d = BDD_FALSE)
+		{
+			if(!mgr->wantsGC())
+				return;
+			std::vector<bdd> roots;
+			roots.push_back(trans);
+			roots.push_back(valid);
+			roots.push_back(a); roots.push_back(b); roots.push_back(c); roots.push_back(d);
+			for(std::set<bdd_set*>::iterator it = live.begin(); it != live.end(); ++it)
+				roots.push_back((*it)->root);
+			mgr->gc(roots);
+		}
+
+		// One more fixpoint iteration, when counting.
+		void iterated()
+		{
+			if(counters)
+				counters->iterations++;
+		}
+
+		// Number of assignments to bits i.. of x that satisfy p; memo
+		// holds the count of each node below its own variable.
+		long long countStates(bdd p, int i, std::map<bdd, long long>& memo)
+		{
+			if(p == BDD_FALSE)
+				return 0;
+			if(p == BDD_TRUE)
+				return 1LL << (num_bits - i);
+			int v = mgr->var(p) / 2;
+			std::map<bdd, long long>::iterator it = memo.find(p);
+			if(it == memo.end())
+				it = memo.insert(std::make_pair(p, countStates(mgr->low(p), v+1, memo)
+					+ countStates(mgr->high(p), v+1, memo))).first;
+			return it->second << (v - i);
+		}
+
+		bdd preImage(bdd p) // EX p
+		{
+			return mgr->andExists(trans, mgr->rename(p, to_next), next_vars);
+		}
+
+		bdd allPreImage(bdd p) // AX p
+		{
+			return mgr->DIFF(valid, preImage(mgr->DIFF(valid, p)));
+		}
+
+		bdd untilE(bdd p, bdd q) // E p U q, one frontier at a time
+		{
+			bdd z = q, frontier = q;
+			while(frontier != BDD_FALSE)
+			{
+				frontier = mgr->DIFF(mgr->AND(p, preImage(frontier)), z);
+				z = mgr->OR(z, frontier);
+				iterated();
+				checkpoint(p, q, z, frontier);
+			}
+			return z;
+		}
+
+		bdd untilA(bdd p, bdd q) // A p U q, least fixpoint of q | (p & AX Z)
+		{
+			bdd z = q, prev;
+			do
+			{
+				prev = z;
+				z = mgr->OR(q, mgr->AND(p, allPreImage(z)));
+				iterated();
+				checkpoint(p, q, z);
+			} while(z != prev);
+			return z;
+		}
+
+		// f(s) for every state s of p, in increasing order
+		template <class F>
+		void forStates(bdd p, int i, state_id s, const F& f)
+		{
+			if(p == BDD_FALSE)
+				return;
+			if(i == num_bits)
+			{
+				f(s);
+				return;
+			}
+			if(mgr->var(p) == curVar(i))
+			{
+				forStates(mgr->low(p), i+1, s << 1, f);
+				forStates(mgr->high(p), i+1, (s << 1) | 1, f);
+			}
+			else
+			{
+				forStates(p, i+1, s << 1, f);
+				forStates(p, i+1, (s << 1) | 1, f);
+			}
+		}
+
+	public:
+	model_symbolic() : model()
+	{
+		num_srcs = 0;
+		num_bits = 0;
+		mgr = 0;
+		counters = 0;
+		trans = valid = BDD_FALSE;
+	}
+
+	~model_symbolic()
+	{
+		delete mgr;
+	}
+
+	void setCounters(op_counters* c)
+	{
+		counters = c;
+	}
+
+	void setNumStates(int n)
+	{
+		num_srcs = n;
+		num_bits = 1;
+		while(num_bits < 31 && (1 << num_bits) < n)
+			num_bits++;
+
+		delete mgr;
+		mgr = new bdd_manager(2*num_bits);
+		std::vector<int> ys, map(2*num_bits);
+		for(int i = 0; i < num_bits; i++)
+		{
+			ys.push_back(nextVar(i));
+			map[curVar(i)] = nextVar(i);
+			map[nextVar(i)] = nextVar(i);
+		}
+		next_vars = mgr->newVarSet(ys);
+		to_next = mgr->newRenaming(map);
+		valid = (n > 0) ? atMost(n-1, 0) : BDD_FALSE;
+	}
+
+	bool isValidState(state_id s)
+	{
+		return (s>=0 && s<=num_srcs-1);
+	}
+
+	int getNumStates()
+	{
+		return num_srcs;
+	}
+
+	void addArc(state_id s1, state_id s2)
+	{
+		arc_buf.push_back(std::make_pair(s1, s2));
+	}
+
+	bool finish()
+	{
+		// same checks, in the same order and with the same messages,
+		// as the explicit model
+		std::sort(arc_buf.begin(), arc_buf.end());
+		int tag=-1;
+		for(size_t k = 0; k < arc_buf.size(); k++)
+		{
+			int frt = arc_buf[k].first, snd = arc_buf[k].second;
+			if(!isValidState(frt) || !isValidState(snd))
+			{
+				*messages<<"\nState "<< (isValidState(frt) ? snd : frt) <<" does not lie between ["<< 0 <<","<<num_srcs-1<<"] \n";
+				return false;
+			}
+			if(frt==tag+1)
+				tag = frt;
+			else if(frt>tag+1)
+			{
+				*messages<<"\nState "<< tag+1 <<" does not have any outgoing edge \n";
+				return false;
+			}
+		}
+		if(tag+1 < num_srcs)
+		{
+			*messages<<"\nState "<< tag+1 <<" does not have any outgoing edge \n";
+			return false;
+		}
+
+		trans = relation(arc_buf);
+		std::vector<pairs>().swap(arc_buf);
+		return true;
+	}
+
+	bool changeArcs(const std::vector<pairs>& added, const std::vector<pairs>& removed)
+	{
+		for(size_t k = 0; k < added.size(); k++)
+		{
+			int frt = added[k].first, snd = added[k].second;
+			if(!isValidState(frt) || !isValidState(snd))
+			{
+				*messages<<"\nState "<< (isValidState(frt) ? snd : frt) <<" does not lie between ["<< 0 <<","<<num_srcs-1<<"] \n";
+				return false;
+			}
+		}
+		bdd with_added = mgr->OR(trans, relation(added));
+		for(size_t k = 0; k < removed.size(); k++) // only arcs of the model, or added with them, can be removed
+		{
+			int frt = removed[k].first, snd = removed[k].second;
+			if(!isValidState(frt) || !isValidState(snd))
+			{
+				*messages<<"\nState "<< (isValidState(frt) ? snd : frt) <<" does not lie between ["<< 0 <<","<<num_srcs-1<<"] \n";
+				return false;
+			}
+			if(mgr->AND(with_added, relation(std::vector<pairs>(1, removed[k]))) == BDD_FALSE)
+			{
+				*messages<<"\nArc S"<< frt <<" -> S"<< snd <<" is not in the model \n";
+				return false;
+			}
+		}
+
+		bdd t = mgr->DIFF(with_added, relation(removed));
+		bdd dead = mgr->DIFF(valid, mgr->andExists(t, BDD_TRUE, next_vars)); // states without a successor
+		if(dead != BDD_FALSE)
+		{
+			*messages<<"\nState "<< firstState(dead) <<" does not have any outgoing edge \n";
+			return false;
+		}
+		trans = t;
+		checkpoint();
+		return true;
+	}
+
+	state_set* makeEmptySet()
+	{
+		bdd_set* t = new bdd_set();
+		live.insert(t);
+		return t;
+	}
+
+	void deleteSet(state_set* sset)
+	{
+		live.erase(bset(sset));
+		delete bset(sset);
+	}
+
+	void addState(state_id s, state_set* sset)
+	{
+		if(isValidState(s))
+			bset(sset)->root = mgr->OR(root(sset), minterm(s));
+		checkpoint();
+	}
+
+	void copy(const state_set* sset, state_set* rset)
+	{
+		bset(rset)->root = root(sset);
+	}
+
+	bool elementOf(state_id s, const state_set* sset)
+	{
+		if(!isValidState(s))
+			return false;
+		bdd p = root(sset);
+		while(p != BDD_FALSE && p != BDD_TRUE)
+			p = bitOf(s, mgr->var(p)/2) ? mgr->high(p) : mgr->low(p);
+		return p == BDD_TRUE;
+	}
+
+	bool isSubset(const state_set* sset1, const state_set* sset2)
+	{
+		return mgr->DIFF(root(sset1), root(sset2)) == BDD_FALSE;
+	}
+
+	void getWords(const state_set* sset, std::vector<uint64_t>& words)
+	{
+		words.assign((num_srcs + 63) / 64, 0);
+		forStates(root(sset), 0, 0, [&](state_id s) { words[s / 64] |= uint64_t(1) << (s % 64); });
+	}
+
+	long long cardinality(const state_set* sset) // sets only hold valid states
+	{
+		std::map<bdd, long long> memo;
+		return countStates(root(sset), 0, memo);
+	}
+
+	void NOT(const state_set* sset, state_set* rset)
+	{
+		checkpoint();
+		bset(rset)->root = mgr->DIFF(valid, root(sset));
+	}
+
+	void AND(const state_set* sset1, const state_set* sset2, state_set* rset)
+	{
+		checkpoint();
+		bset(rset)->root = mgr->AND(root(sset1), root(sset2));
+	}
+
+	void OR(const state_set* sset1, const state_set* sset2, state_set* rset)
+	{
+		checkpoint();
+		bset(rset)->root = mgr->OR(root(sset1), root(sset2));
+	}
+
+	void IMPLIES(const state_set* sset1, const state_set* sset2, state_set* rset)
+	{
+		checkpoint();
+		bset(rset)->root = mgr->OR(mgr->DIFF(valid, root(sset1)), root(sset2));
+	}
+
+	void EX(const state_set* sset, state_set* rset)
+	{
+		checkpoint();
+		bset(rset)->root = preImage(root(sset));
+	}
+
+	void AX(const state_set* sset, state_set* rset)
+	{
+		checkpoint();
+		bset(rset)->root = allPreImage(root(sset));
+	}
+
+	void EF(const state_set* sset, state_set* rset)
+	{
+		checkpoint();
+		bset(rset)->root = untilE(valid, root(sset));
+	}
+
+	void AF(const state_set* sset, state_set* rset)
+	{
+		checkpoint();
+		bset(rset)->root = untilA(valid, root(sset));
+	}
+
+	void EU(const state_set* sset1, const state_set* sset2, state_set* rset)
+	{
+		checkpoint();
+		bset(rset)->root = untilE(root(sset1), root(sset2));
+	}
+
+	void AU(const state_set* sset1, const state_set* sset2, state_set* rset)
+	{
+		checkpoint();
+		bset(rset)->root = untilA(root(sset1), root(sset2));
+	}
+
+	void EG(const state_set* sset, state_set* rset) // greatest fixpoint of p & EX Z
+	{
+		checkpoint();
+		bdd p = root(sset), z = p, prev;
+		do
+		{
+			prev = z;
+			z = mgr->AND(p, preImage(z));
+			iterated();
+			checkpoint(p, z);
+		} while(z != prev);
+		bset(rset)->root = z;
+	}
+
+	void AG(const state_set* sset, state_set* rset) // !EF !p
+	{
+		checkpoint();
+		bdd bad = untilE(valid, mgr->DIFF(valid, root(sset)));
+		bset(rset)->root = mgr->DIFF(valid, bad);
+	}
+
+	void display(const state_set* sset, std::ostream& out)
+	{
+		out << ":";
+		forStates(root(sset), 0, 0, [&](state_id s) { out << s << "  "; });
+		out << "\n";
+	}
+};
+
+model* makeSymbolicModel(int debug_level)
+{
+	return new model_symbolic();
+}
@@ -0,0 +1,120 @@
+
+#include "thread_pool.h"
+
+// Pool and queue of the current thread, if it belongs to a pool.
+static thread_local const thread_pool* my_pool = 0;
+static thread_local int my_index = 0;
+
+thread_pool::thread_pool(int n)
+: num_threads(n < 1 ? 1 : n), queued(0), stop(false)
+{
+  for (int i = 0; i < num_threads; i++) queues.push_back(new task_queue);
+  for (int i = 1; i < num_threads; i++) threads.push_back(std::thread(&thread_pool::worker, this, i));
+}
+
+thread_pool::~thread_pool()
+{
+  {
+    std::lock_guard<std::mutex> lk(sleep_lock);
+    stop = true;
+  }
+  wakeup.notify_all();
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+  for (size_t i = 0; i < queues.size(); i++) delete queues[i];
+}
+
+int thread_pool::myQueue() const
+{
+  return (my_pool == this) ? my_index : 0;
+}
+
+thread_pool::task* thread_pool::take(int me)
+{
+  if (queued.load(std::memory_order_acquire) == 0) return 0;
+
+  // own queue first, newest task: it is the most likely to be in cache
+  {
+    task_queue* q = queues[me];
+    std::lock_guard<std::mutex> lk(q->lock);
+    if (!q->tasks.empty()) {
+      task* t = q->tasks.back();
+      q->tasks.pop_back();
+      queued--;
+      return t;
+    }
+  }
+  // then steal the oldest task of somebody else
+  for (int k = 1; k < num_threads; k++) {
+    task_queue* q = queues[(me + k) % num_threads];
+    std::lock_guard<std::mutex> lk(q->lock);
+    if (!q->tasks.empty()) {
+      task* t = q->tasks.front();
+      q->tasks.pop_front();
+      queued--;
+      return t;
+    }
+  }
+  return 0;
+}
+
+void thread_pool::execute(task* t)
+{
+  t->fn(t->body, t->lo, t->hi);
+  t->pending->fetch_sub(1, std::memory_order_release);
+}
+
+void thread_pool::worker(int me)
+{
+  my_pool = this;
+  my_index = me;
+  while (!stop) {
+    task* t = take(me);
+    if (t) {
+      execute(t);
+      continue;
+    }
+    std::unique_lock<std::mutex> lk(sleep_lock);
+    if (!stop && queued.load() == 0) wakeup.wait(lk);
+  }
+}
+
+void thread_pool::run(int begin, int end, int grain, body_fn fn, const void* body)
+{
+  if (grain < 1) grain = 1;
+  int chunks = (end - begin + grain - 1) / grain;
+  if (chunks <= 0) return;
+  if (chunks == 1 || num_threads == 1) {
+    fn(body, begin, end);
+    return;
+  }
+
+  std::atomic<int> pending(chunks);
+  std::vector<task> tasks(chunks);
+  int me = myQueue();
+  {
+    task_queue* q = queues[me];
+    std::lock_guard<std::mutex> lk(q->lock);
+    // pushed last chunk first, so the owner starts at the beginning
+    for (int k = chunks - 1; k >= 0; k--) {
+      tasks[k].fn = fn;
+      tasks[k].body = body;
+      tasks[k].lo = begin + k * grain;
+      tasks[k].hi = (k == chunks - 1) ? end : tasks[k].lo + grain;
+      tasks[k].pending = &pending;
+      q->tasks.push_back(&tasks[k]);
+    }
+    queued += chunks;
+  }
+  {
+    std::lock_guard<std::mutex> lk(sleep_lock);
+  }
+  wakeup.notify_all();
+
+  // help until every chunk of this call has run; chunks of other
+  // calls may be run meanwhile, which is what makes nesting work
+  while (pending.load(std::memory_order_acquire) > 0) {
+    task* t = take(me);
+    if (t) execute(t);
+    else std::this_thread::yield();
+  }
+}
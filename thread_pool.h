@@ -0,0 +1,83 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+  Work-stealing thread pool, used by the model to run labeling
+  operations on several cores.
+
+  Every thread of the pool owns a queue of tasks. A thread takes work
+  from the back of its own queue, and steals from the front of the
+  others when its own queue is empty. Threads that are not part of
+  the pool (the main thread, typically) share queue 0.
+
+  The only way to submit work is parallel_for(), which does not return
+  until all of its chunks have run. The calling thread runs chunks
+  while it waits, so parallel_for() may be called from inside a chunk.
+*/
+class thread_pool {
+  public:
+    /// Pool using n threads in total, the calling thread included.
+    explicit thread_pool(int n);
+    ~thread_pool();
+
+    /// Number of threads, the calling thread included.
+    int size() const { return num_threads; }
+
+    /// Index of the calling thread: 1 to size()-1 for the threads of
+    /// the pool, 0 for any other.
+    int threadIndex() const { return myQueue(); }
+
+    /**
+        Run body(lo, hi) over consecutive sub-ranges [lo, hi) covering
+        [begin, end), of at most grain elements each, and wait for all
+        of them. Sub-range k starts at begin + k*grain.
+    */
+    template <class F>
+    void parallel_for(int begin, int end, int grain, const F& body) {
+      run(begin, end, grain, &call<F>, &body);
+    }
+
+  private:
+    typedef void (*body_fn)(const void* body, int lo, int hi);
+
+    template <class F>
+    static void call(const void* body, int lo, int hi) {
+      (*static_cast<const F*>(body))(lo, hi);
+    }
+
+    struct task {
+      body_fn fn;
+      const void* body;
+      int lo, hi;
+      std::atomic<int>* pending;
+    };
+
+    struct task_queue {
+      std::mutex lock;
+      std::deque<task*> tasks;
+    };
+
+    void run(int begin, int end, int grain, body_fn fn, const void* body);
+    void worker(int me);
+    int myQueue() const;
+    task* take(int me);
+    void execute(task* t);
+
+    int num_threads;
+    std::vector<std::thread> threads;
+    std::vector<task_queue*> queues;
+
+    std::atomic<int> queued;   // tasks sitting in any queue
+    std::atomic<bool> stop;
+    std::mutex sleep_lock;
+    std::condition_variable wakeup;
+};
+
+#endif